@@ -0,0 +1,115 @@
+//
+//  bench.c
+//  filagree
+//
+//  times the library routines that have their own fast paths; make bench,
+//  or filagree_bench [threads] to sort on other than one thread per processor
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "vm.h"
+#include "sys.h"
+#include "serial.h"
+#include "variable.h"
+
+static double now()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+// sorts n random ints with list.sort, as a script would, and checks the order
+static void bench_sort(struct context *context, uint32_t n, uint32_t threads, bool stable)
+{
+    struct array *items = array_new_size(n);
+    srand(n);
+    for (uint32_t i=0; i<n; i++)
+        array_add(items, variable_new_int(context, rand()));
+    struct variable *list = variable_new_list(context, items);
+
+    struct variable *args = variable_new_src(context, 0);
+    array_add(args->list, list);
+    if (stable)
+        array_add(args->list, variable_new_bool(context, true));
+    struct variable *name = variable_new_str(context, byte_array_from_string("sort"));
+    struct variable *sort = builtin_method(context, list, name);
+
+    context->sort_threads = threads;
+    stack_push(context->operand_stack, args);
+    double start = now();
+    sort->cfnc(context);
+    double took = now() - start;
+
+    for (uint32_t i=1; i<n; i++) {
+        struct variable *a = (struct variable*)array_get(list->list, i-1);
+        struct variable *b = (struct variable*)array_get(list->list, i);
+        if (a->integer > b->integer)
+            exit_message("sort %u: out of order at %u", n, i);
+    }
+    printf("sort %9u ints, %2u threads%s: %.3fs\n", n, threads, stable ? ", stable" : "        ", took);
+}
+
+// compresses and decompresses raw reps times, and checks the round trip
+static void bench_codec(const char *name, const struct byte_array *raw, int reps)
+{
+    struct byte_array *packed = NULL, *unpacked = NULL;
+    double start = now();
+    for (int i=0; i<reps; i++) {
+        if (packed)
+            byte_array_del(packed);
+        packed = serial_compress(NULL, raw);
+    }
+    double compressing = now() - start;
+
+    start = now();
+    for (int i=0; i<reps; i++) {
+        if (unpacked)
+            byte_array_del(unpacked);
+        byte_array_reset(packed);
+        unpacked = serial_decompress(packed);
+    }
+    double decompressing = now() - start;
+
+    if (!unpacked || !byte_array_equals(raw, unpacked))
+        exit_message("%s: round trip differs", name);
+    double mb = raw->length * (double)reps / 1e6;
+    printf("%-6s %8u -> %8u bytes: compress %5.0f MB/s, decompress %5.0f MB/s\n",
+           name, raw->length, packed->length, mb / compressing, mb / decompressing);
+    byte_array_del(packed);
+    byte_array_del(unpacked);
+}
+
+int main(int argc, char **argv)
+{
+    struct context *context = context_new(true);
+    uint32_t threads = argc > 1 ? (uint32_t)atoi(argv[1]) : cpu_count();
+
+    for (uint32_t n = 100000; n <= 10000000; n *= 10) {
+        bench_sort(context, n, 1, false);
+        bench_sort(context, n, 1, true);
+        if (threads > 1) {
+            bench_sort(context, n, threads, false);
+            bench_sort(context, n, threads, true);
+        }
+    }
+
+    uint32_t size = 8 << 20;
+    struct byte_array *random = byte_array_new_size(size);
+    struct byte_array *text = byte_array_new_size(size);
+    const char *words[] = {"the ", "quick ", "brown ", "fox ", "jumps ", "over ", "lazy ", "dog\n"};
+    srand(size);
+    for (uint32_t i=0; i<size; i++)
+        random->data[i] = (uint8_t)rand();
+    for (uint32_t i=0; i<size;) {
+        const char *word = words[rand() % 8];
+        for (; *word && i<size; word++)
+            text->data[i++] = *word;
+    }
+    bench_codec("random", random, 5);
+    bench_codec("text", text, 5);
+    return 0;
+}
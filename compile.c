@@ -4,6 +4,8 @@
 #include <stdarg.h>
 #include <ctype.h>
 #include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #include "util.h"
 #include "struct.h"
@@ -290,8 +292,8 @@ int import(const char* input, int i)
     byte_array_append(path, byte_array_from_string(EXTENSION_SRC));
 
     if (!map_has(imports, path)) {
-        map_insert(imports, path, NULL);
         struct byte_array *imported = read_file(path);
+        map_insert(imports, path, imported); // contents are kept for the byte code cache
         lex(imported);
     }
 
@@ -1516,6 +1518,172 @@ void compile_file(const char* str)
     struct byte_array *dotfgbc = byte_array_from_string(EXTENSION_BC);
     int offset = byte_array_find(filename, dotfg, 0);
     assert_message(offset > 0, "invalid source file name");
-    byte_array_replace(filename, dotfgbc, offset, dotfg->length);
+    filename = byte_array_replace(filename, dotfgbc, offset, dotfg->length);
     write_file(filename, program);
 }
+
+// cache ///////////////////////////////////////////////////////////////////
+
+// A cache entry is named by the hash of the source file and of the build of
+// the compiler, and holds the hash of every file it imported, so an edit to
+// any of them means a rebuild:
+//
+//  [version] [build] [number of imports] ([path] [hash])* [byte code] [hash of all that]
+//
+// Entries go in $FILAGREE_CACHE, else $XDG_CACHE_HOME/filagree, else
+// ~/.cache/filagree, else .fgcache beside the source.
+
+#define CACHE_VERSION   2
+#define CACHE_BUILD     __DATE__ " " __TIME__   // byte code may change with the compiler
+#define HASH_SIZE       sizeof(uint64_t)
+
+static struct byte_array *hash_of(const struct byte_array *bytes)
+{
+    uint64_t hash = hash_bytes(bytes->data, bytes->length, 0);
+    struct byte_array *h = byte_array_new_size(HASH_SIZE);
+    memcpy(h->data, &hash, HASH_SIZE);
+    return h;
+}
+
+static bool file_exists(const struct byte_array *path)
+{
+    struct stat st;
+    char *str = byte_array_to_string(path);
+    bool exists = !stat(str, &st);
+    free(str);
+    return exists;
+}
+
+static void cache_dir(char *dir, size_t size, const struct byte_array *filename)
+{
+    const char *env = getenv(CACHE_DIR_ENV);
+    const char *home = getenv(CACHE_HOME_ENV);
+    if (env)
+        snprintf(dir, size, "%s", env);
+    else if (home && *home)
+        snprintf(dir, size, "%s/%s", home, CACHE_HOME_DIR);
+    else if ((home = getenv("HOME")) && *home)
+        snprintf(dir, size, "%s/.cache/%s", home, CACHE_HOME_DIR);
+    else {
+        char *source = byte_array_to_string(filename);
+        char *slash = strrchr(source, '/');
+        if (slash)
+            slash[1] = 0;
+        snprintf(dir, size, "%s%s", slash ? source : "", CACHE_DIR);
+        free(source);
+    }
+}
+
+static struct byte_array *cache_path(const struct byte_array *filename, const struct byte_array *source)
+{
+    char dir[FILENAME_MAX];
+    cache_dir(dir, sizeof(dir), filename);
+    uint64_t build = hash_bytes((const uint8_t*)CACHE_BUILD, strlen(CACHE_BUILD), CACHE_VERSION);
+    uint64_t hash = hash_bytes(source->data, source->length, build);
+    char path[sizeof(dir) + sizeof("/0123456789abcdef" EXTENSION_BC)];
+    snprintf(path, sizeof(path), "%s/%016" PRIx64 "%s", dir, hash, EXTENSION_BC);
+    return byte_array_from_string(path);
+}
+
+// makes the directory path is in, and any it is in
+static void cache_mkdir(const struct byte_array *path)
+{
+    char *dir = byte_array_to_string(path);
+    char *end = strrchr(dir, '/');
+    for (char *slash = dir; end && (slash = strchr(slash + 1, '/')) && slash <= end;) {
+        *slash = 0;
+        mkdir(dir, 0755);
+        *slash = '/';
+    }
+    free(dir);
+}
+
+static bool cache_fresh(const struct byte_array *import, const struct byte_array *was)
+{
+    if (!file_exists(import))
+        return false;
+    struct byte_array *contents = read_file(import);
+    struct byte_array *is = hash_of(contents);
+    bool fresh = byte_array_equals(was, is);
+    byte_array_del(contents);
+    byte_array_del(is);
+    return fresh;
+}
+
+// the byte code of a current entry, else NULL; a stale entry is unmapped
+static struct byte_array *cache_load(const struct byte_array *path)
+{
+    if (!file_exists(path))
+        return NULL;
+    struct byte_array *entry = mmap_file(path);
+    bool fresh = entry->length >= HASH_SIZE;
+    if (fresh) {
+        uint64_t hash;
+        uint32_t length = entry->length - HASH_SIZE;
+        memcpy(&hash, entry->data + length, HASH_SIZE);
+        fresh = hash == hash_bytes(entry->data, length, 0); // else truncated or corrupt
+    }
+    byte_array_reset(entry);
+    if (fresh)
+        fresh = serial_decode_int(entry) == CACHE_VERSION;
+    if (fresh) {
+        struct byte_array *build = serial_decode_string(entry);
+        struct byte_array *ours = byte_array_from_string(CACHE_BUILD);
+        fresh = byte_array_equals(build, ours);
+        byte_array_del(build);
+        byte_array_del(ours);
+    }
+    for (int32_t n = fresh ? serial_decode_int(entry) : 0; n > 0 && fresh; n--) {
+        struct byte_array *import = serial_decode_string(entry);
+        struct byte_array *was = serial_decode_string(entry);
+        fresh = cache_fresh(import, was);
+        byte_array_del(import);
+        byte_array_del(was);
+    }
+    if (!fresh) {
+        unmap_file(entry);
+        return NULL;
+    }
+    return serial_decode_view(entry); // the mapping lasts as long as the program
+}
+
+static void cache_store(const struct byte_array *path, const struct byte_array *program)
+{
+    struct byte_array *entry = serial_encode_int(NULL, CACHE_VERSION);
+    struct byte_array *build = byte_array_from_string(CACHE_BUILD);
+    serial_encode_string(entry, build);
+    byte_array_del(build);
+    const void *imported;
+    void *contents;
+    serial_encode_int(entry, imports->length);
+    for (uint32_t i=0; map_iter(imports, &i, &imported, &contents);) {
+        struct byte_array *hash = hash_of((struct byte_array*)contents);
+        serial_encode_string(entry, (const struct byte_array*)imported);
+        serial_encode_string(entry, hash);
+        byte_array_del(hash);
+    }
+    serial_encode_string(entry, program);
+    struct byte_array *hash = hash_of(entry);
+    byte_array_append(entry, hash);
+    byte_array_del(hash);
+
+    cache_mkdir(path);
+    write_file(path, entry); // which renames, so other processes never see half an entry
+    byte_array_del(entry);
+}
+
+// builds a source file, or reuses its byte code if neither it nor its imports changed
+struct byte_array *build_file_cached(const struct byte_array* filename)
+{
+    struct byte_array *input = read_file(filename);
+    struct byte_array *path = cache_path(filename, input);
+    struct byte_array *program = cache_load(path);
+    if (program) {
+        DEBUGPRINT("cached %s\n", byte_array_to_string(path));
+        return program;
+    }
+
+    program = build_string(input);
+    cache_store(path, program);
+    return program;
+}
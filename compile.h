@@ -4,9 +4,14 @@
 
 #define EXTENSION_SRC    ".fg"
 #define EXTENSION_BC     ".fgbc"
+#define CACHE_DIR        ".fgcache"       // beside the source, if there is no home
+#define CACHE_DIR_ENV    "FILAGREE_CACHE"
+#define CACHE_HOME_ENV   "XDG_CACHE_HOME"
+#define CACHE_HOME_DIR   "filagree"
 
 struct byte_array *build_string(const struct byte_array *input);
 struct byte_array *build_file(const struct byte_array* filename);
+struct byte_array *build_file_cached(const struct byte_array* filename);
 void compile_file(const char* str);
 
 #endif // COMPILE_H
@@ -1,4 +1,14 @@
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "hal.h"
+#include "util.h"
+#include "variable.h"
 
 void hal_loop() {}
 void hal_graphics(const struct variable *shape) {}
@@ -28,7 +38,334 @@ void hal_table (struct context *context,
                 struct variable *list, struct variable *logic) {}
 void hal_sound_url(const char *address) {}
 void hal_sound_bytes(const uint8_t *bytes, uint32_t length) {}
-void hal_save(struct context *context, const struct byte_array *key, const struct variable *value) {}
-struct variable *hal_load(struct context *context, const struct byte_array *key) { return NULL; }
 void hal_save_form(struct context *context, const struct byte_array *key) {}
 void hal_load_form(struct context *context, const struct byte_array *key) {}
+
+// key-value store /////////////////////////////////////////////////////////
+//
+// hal_save appends a record to a log: a checksum of the rest of it, the key
+// and value lengths, the key, and the value serialized, or no value to
+// delete the key. An index in memory maps each key to its latest value.
+// Records are written in batches, and a background thread syncs them every
+// KV_SYNC_MS, so a crash loses at most that much; opening the log cuts off
+// a torn or corrupt tail. Once the log is past KV_COMPACT_MIN and at least
+// half of it is dead, the same thread copies the live records into a new
+// log, which replaces the old one. Offsets are 32-bit, so a put that would
+// take the log past 4 GB, even once compacted, is refused. Nothing fails
+// while holding kv_lock, so the atexit flush can always take it.
+
+#define KV_PATH_ENV     "FILAGREE_KV"
+#define KV_PATH         ".fgkv"
+#define KV_HEADER       12          // checksum, key length, value length
+#define KV_BATCH        65536       // bytes of records written at once
+#define KV_SYNC_MS      50
+#define KV_COMPACT_MIN  (1 << 20)
+#define KV_FULL         "key-value log would pass 4 GB"
+
+struct kv_entry {
+    uint32_t offset;                // of the value in the log
+    uint32_t length;
+};
+
+struct kv_log {
+    int fd;
+    char *path;
+    struct map *index;              // key -> kv_entry
+    struct byte_array *pending;     // records not yet written
+    uint32_t written;               // log length on disk
+    uint32_t live;                  // bytes of records still indexed
+    bool dirty;                     // written since the last sync
+};
+
+static struct kv_log *kv = NULL;
+static pthread_mutex_t kv_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint32_t kv_checksum(const uint8_t *record, uint32_t size)
+{
+    return (uint32_t)hash_bytes(record + sizeof(uint32_t), size - sizeof(uint32_t), 0);
+}
+
+// points key at the value of the record at offset, or drops it for no value
+static void kv_index(struct kv_log *log, const struct byte_array *key, uint32_t offset, uint32_t length)
+{
+    struct kv_entry *entry = (struct kv_entry*)map_get(log->index, key);
+    if (entry)
+        log->live -= KV_HEADER + key->length + entry->length;
+    if (!length) {
+        if (entry) {
+            map_remove(log->index, key);
+            free(entry);
+        }
+        return;
+    }
+    if (!entry) {
+        entry = (struct kv_entry*)malloc(sizeof(struct kv_entry));
+        map_insert(log->index, key, entry);
+    }
+    entry->offset = offset + KV_HEADER + key->length;
+    entry->length = length;
+    log->live += KV_HEADER + key->length + length;
+}
+
+static bool kv_write(int fd, const uint8_t *data, uint32_t length)
+{
+    while (length) {
+        ssize_t n = write(fd, data, length);
+        if (n <= 0)
+            return false;
+        data += n;
+        length -= (uint32_t)n;
+    }
+    return true;
+}
+
+// false if the pending records couldn't be written, which leaves them
+// pending and the log as it was, or couldn't be synced
+static bool kv_flush(struct kv_log *log, bool sync)
+{
+    if (log->pending->length) {
+        if (!kv_write(log->fd, log->pending->data, log->pending->length)) {
+            int cut = ftruncate(log->fd, log->written); // drop what got through
+            (void)cut; // else opening the log cuts it off
+            return false;
+        }
+        log->written += log->pending->length;
+        byte_array_resize(log->pending, 0);
+        log->dirty = true;
+    }
+    if (sync && log->dirty) {
+        if (fsync(log->fd))
+            return false;
+        log->dirty = false;
+    }
+    return true;
+}
+
+// copies the live records into a new log, and renames it over the old one
+static void kv_compact(struct kv_log *log)
+{
+    if (!kv_flush(log, false))
+        return;
+    char *path = (char*)malloc(strlen(log->path) + 5);
+    sprintf(path, "%s.tmp", log->path);
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_APPEND, 0644); // becomes the log
+    if (fd < 0) {
+        free(path);
+        return;
+    }
+
+    struct byte_array *batch = byte_array_new_size(0);
+    uint32_t *moved = (uint32_t*)malloc(sizeof(uint32_t) * (log->index->length + 1));
+    uint32_t at = 0, n = 0;
+    bool ok = true;
+    const void *key;
+    void *value;
+    for (uint32_t i=0; ok && map_iter(log->index, &i, &key, &value); n++) {
+        const struct byte_array *k = (const struct byte_array*)key;
+        const struct kv_entry *entry = (const struct kv_entry*)value;
+        uint32_t size = KV_HEADER + k->length + entry->length;
+        uint32_t from = batch->length;
+        byte_array_resize(batch, from + size);
+        ok = pread(log->fd, batch->data + from, size, entry->offset - KV_HEADER - k->length) == size;
+        moved[n] = at + from + KV_HEADER + k->length;
+        if (batch->length >= KV_BATCH) {
+            ok = ok && write(fd, batch->data, batch->length) == batch->length;
+            at += batch->length;
+            byte_array_resize(batch, 0);
+        }
+    }
+    ok = ok && write(fd, batch->data, batch->length) == batch->length;
+    at += batch->length;
+    ok = ok && !fsync(fd) && !rename(path, log->path);
+    byte_array_del(batch);
+
+    if (!ok) {
+        close(fd);
+        unlink(path);
+    } else {
+        n = 0;
+        for (uint32_t i=0; map_iter(log->index, &i, NULL, &value); n++)
+            ((struct kv_entry*)value)->offset = moved[n];
+        close(log->fd);
+        log->fd = fd;
+        log->written = log->live = at;
+        log->dirty = false;
+    }
+    free(moved);
+    free(path);
+}
+
+static void *kv_syncer(void *arg)
+{
+    struct kv_log *log = (struct kv_log*)arg;
+    for (;;) {
+        usleep(KV_SYNC_MS * 1000);
+        pthread_mutex_lock(&kv_lock);
+        if (kv_flush(log, true) && // else try again next time
+            log->written >= KV_COMPACT_MIN && log->live <= log->written / 2)
+            kv_compact(log);
+        pthread_mutex_unlock(&kv_lock);
+    }
+    return NULL;
+}
+
+// waits a little for the syncer, but never for a thread exiting with the lock
+static void kv_close()
+{
+    for (int tries = 0; pthread_mutex_trylock(&kv_lock); tries++) {
+        if (tries == KV_SYNC_MS)
+            return;
+        usleep(1000);
+    }
+    kv_flush(kv, true);
+    pthread_mutex_unlock(&kv_lock);
+}
+
+// maps the log, like mmap_file but without exiting; NULL if it can't, or if
+// the log is too big for 32-bit offsets
+static struct byte_array *kv_map(int fd)
+{
+    struct stat st;
+    if (fstat(fd, &st) || st.st_size < 0 || st.st_size > UINT32_MAX)
+        return NULL;
+    if (!st.st_size)
+        return byte_array_new();
+    void *mapped = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (mapped == MAP_FAILED)
+        return NULL;
+    return byte_array_view((uint8_t*)mapped, (uint32_t)st.st_size);
+}
+
+// opens the log named by $FILAGREE_KV, and indexes every record that checks out;
+// NULL if it can't
+static struct kv_log *kv_open()
+{
+    if (kv)
+        return kv;
+    const char *path = getenv(KV_PATH_ENV);
+    if (!path)
+        path = KV_PATH;
+    int fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (fd < 0)
+        return NULL;
+    struct byte_array *bits = kv_map(fd);
+    if (!bits) {
+        close(fd);
+        return NULL;
+    }
+    struct kv_log *log = (struct kv_log*)malloc(sizeof(struct kv_log));
+    log->path = strdup(path);
+    log->fd = fd;
+    log->index = map_new();
+    log->pending = byte_array_new_size(0);
+    log->written = log->live = 0;
+    log->dirty = false;
+
+    uint32_t at = 0, lengths[2];
+    while (bits->length - at >= KV_HEADER) {
+        memcpy(lengths, bits->data + at + sizeof(uint32_t), sizeof(lengths));
+        uint32_t rest = bits->length - at - KV_HEADER, sum;
+        if (lengths[0] > rest || lengths[1] > rest - lengths[0])
+            break;
+        uint32_t size = KV_HEADER + lengths[0] + lengths[1];
+        memcpy(&sum, bits->data + at, sizeof(sum));
+        if (sum != kv_checksum(bits->data + at, size))
+            break;
+        struct byte_array key = {
+            .data = bits->data + at + KV_HEADER,
+            .current = bits->data + at + KV_HEADER,
+            .length = lengths[0],
+            .view = true
+        };
+        kv_index(log, &key, at, lengths[1]);
+        at += size;
+    }
+    bool torn = at < bits->length && ftruncate(log->fd, at); // cut off a torn or corrupt tail
+    unmap_file(bits);
+    if (torn) { // else later records would follow it
+        close(log->fd);
+        const void *key;
+        void *entry;
+        for (uint32_t i=0; map_iter(log->index, &i, &key, &entry);)
+            free(entry);
+        map_del(log->index);
+        byte_array_del(log->pending);
+        free(log->path);
+        free(log);
+        return NULL;
+    }
+    log->written = at;
+
+    pthread_t syncer;
+    if (!pthread_create(&syncer, NULL, &kv_syncer, log))
+        pthread_detach(syncer);
+    atexit(&kv_close);
+    return kv = log;
+}
+
+void hal_save(struct context *context, const struct byte_array *key, const struct variable *value)
+{
+    struct byte_array *bits = NULL;
+    if (value && value->type != VAR_NIL)
+        bits = variable_serialize(context, context_buffer(context), value, true);
+    pthread_mutex_lock(&kv_lock);
+    struct kv_log *log = kv_open();
+    if (!log) {
+        pthread_mutex_unlock(&kv_lock);
+        vm_exit_message(context, ERROR_FOPEN);
+    }
+    uint32_t length = bits ? bits->length : 0;
+    uint64_t size = (uint64_t)KV_HEADER + key->length + length;
+    if (log->written + log->pending->length + size > UINT32_MAX && log->live + size <= UINT32_MAX)
+        kv_compact(log);
+    if (log->written + log->pending->length + size > UINT32_MAX) {
+        pthread_mutex_unlock(&kv_lock);
+        vm_exit_message(context, KV_FULL);
+    }
+    struct byte_array *pending = log->pending;
+    uint32_t at = pending->length;
+    uint32_t lengths[2] = {key->length, length};
+    byte_array_resize(pending, at + size);
+    uint8_t *record = pending->data + at;
+    memcpy(record + sizeof(uint32_t), lengths, sizeof(lengths));
+    memcpy(record + KV_HEADER, key->data, key->length);
+    if (length)
+        memcpy(record + KV_HEADER + key->length, bits->data, length);
+    uint32_t sum = kv_checksum(record, size);
+    memcpy(record, &sum, sizeof(sum));
+    uint32_t offset = log->written + at;
+    bool flushed = pending->length < KV_BATCH || kv_flush(log, false);
+    if (flushed) // else the put failed, so nothing may read or write its record
+        kv_index(log, key, offset, length);
+    else
+        byte_array_resize(pending, at);
+    pthread_mutex_unlock(&kv_lock);
+    vm_assert(context, flushed, ERROR_FWRITE);
+}
+
+// the value last saved for key, or nil
+struct variable *hal_load(struct context *context, const struct byte_array *key)
+{
+    pthread_mutex_lock(&kv_lock);
+    struct kv_log *log = kv_open();
+    if (!log) {
+        pthread_mutex_unlock(&kv_lock);
+        vm_exit_message(context, ERROR_FOPEN);
+    }
+    const struct kv_entry *entry = (const struct kv_entry*)map_get(log->index, key);
+    struct byte_array *bits = entry ? byte_array_new_size(entry->length) : NULL;
+    bool read = true;
+    if (entry && entry->offset >= log->written)
+        memcpy(bits->data, log->pending->data + entry->offset - log->written, entry->length);
+    else if (entry)
+        read = pread(log->fd, bits->data, entry->length, entry->offset) == entry->length;
+    pthread_mutex_unlock(&kv_lock);
+    if (!read)
+        byte_array_del(bits);
+    vm_assert(context, read, ERROR_FREAD);
+    if (!bits)
+        return variable_new_nil(context);
+    struct variable *v = variable_deserialize_view(context, bits);
+    byte_array_del(bits);
+    return v;
+}
@@ -6,19 +6,25 @@
 #include "vm.h"
 #include "compile.h"
 #include "interpret.h"
+#include "sys.h"
 
 #define FG_MAX_INPUT     256
-#define ERROR_USAGE    "usage: filagree [file]"
+#define ERROR_USAGE    "usage: filagree [--image image] [file]"
+#define ARG_IMAGE      "--image"
 
 bool run(struct context *context,
          struct byte_array *program,
          struct map *env,
          bool in_context);
 
-void repl()
+void repl(struct map *env)
 {
     char str[FG_MAX_INPUT];
     struct context *context = context_new(true);
+    if (env) {
+        struct program_state *state = (struct program_state*)stack_peek(context->program_stack, 0);
+        state->named_variables = env;
+    }
 
     for (;;) {
         fflush(stdin);
@@ -35,21 +41,26 @@ void repl()
 
         struct byte_array *input = byte_array_from_string(str);
         struct byte_array *program = build_string(input);
-        if (!setjmp(trying))
+        if (!setjmp(trying)) {
+            verify(context, program);
             run(context, program, NULL, true);
+        }
     }
 }
 
-void interpret_file(const struct byte_array *filename, find_c_var *find)
+void interpret_file(const struct byte_array *filename, find_c_var *find, struct map *env)
 {
-    struct byte_array *program = build_file(filename);
-    execute(program, find);
+    struct byte_array *program = build_file_cached(filename);
+    execute_env(program, find, env);
 }
 
-void execute_file(const struct byte_array* filename, find_c_var *find)
+// compile_file replaces the file rather than rewriting it, so the mapping
+// stays whole while it runs
+void execute_file(const struct byte_array* filename, find_c_var *find, struct map *env)
 {
-    struct byte_array *program = read_file(filename);
-    execute(program, find);
+    struct byte_array *program = mmap_file(filename);
+    execute_env(program, find, env);
+    unmap_file(program); // nothing runs that could point into it
 }
 
 void run_file(const char* str, find_c_var *find, struct map *env)
@@ -58,13 +69,13 @@ void run_file(const char* str, find_c_var *find, struct map *env)
     struct byte_array *dotfgbc = byte_array_from_string(EXTENSION_BC);
     int fgbc = byte_array_find(filename, dotfgbc, 0);
     if (fgbc > 0) {
-        execute_file(filename, find);
+        execute_file(filename, find, env);
         return;
     }
     struct byte_array *dotfg = byte_array_from_string(EXTENSION_SRC);
     int fg = byte_array_find(filename, dotfg, 0);
     if (fg > 0)
-        interpret_file(filename, find);
+        interpret_file(filename, find, env);
     else
         printf("invalid file name\n");
 }
@@ -80,6 +91,7 @@ void interpret_string(const char *str, find_c_var *find)
 #ifdef CLI
 
 #include <signal.h>
+#include <string.h>
 
 void sig_handler(const int sig)
 {
@@ -100,8 +112,21 @@ int main (int argc, char** argv)
 	act.sa_flags = 0;
 	sigaction(SIGINT, &act, &oact);
 
+    if (argc > 2 && !strcmp(argv[1], ARG_IMAGE)) { // restore a sys.snapshot
+        struct context *context = context_new(false);
+        if (setjmp(trying))
+            exit_message("%s", byte_array_to_string(context->error->str));
+        struct map *env = sys_image(context, byte_array_from_string(argv[2]));
+        switch (argc) {
+            case 3:     repl(env);                      break;
+            case 4:     run_file(argv[3], NULL, env);   break;
+            default:    exit_message(ERROR_USAGE);      break;
+        }
+        return 0;
+    }
+
     switch (argc) {
-        case 1:     repl();                         break;
+        case 1:     repl(NULL);                     break;
         case 2:     run_file(argv[1], NULL, NULL);  break;
         case 3:     compile_file(argv[1]);          break;
         default:    exit_message(ERROR_USAGE);      break;
@@ -49,10 +49,11 @@ void *incoming_connection(void *arg)
 
         fprintf(stderr, "%d bytes received: %s\n", n, readline);
         struct byte_array *raw_message = byte_array_new_size(n);
-        raw_message->data = (uint8_t*)readline;
+        memcpy(raw_message->data, readline, n);
         int32_t raw_message_length = serial_decode_int(raw_message);
         assert_message(raw_message_length < MAXLINE, "todo: handle long messages");
-        struct variable *message = variable_deserialize(ta->context, raw_message);
+        struct variable *message = variable_deserialize_view(ta->context, raw_message);
+        byte_array_del(raw_message);
 
         struct variable *listener = (struct variable *)map_get(server_listeners, (void*)(VOID_INT)ta->fd);
         vm_call(ta->context, listener, message);
@@ -82,13 +82,33 @@ struct byte_array* serial_decode_string(struct byte_array* buf)
     int32_t len = serial_decode_int(buf);
 	assert_message(len>=0, "negative malloc");
     struct byte_array* ba = byte_array_new_size(len);
-    ba->data = ba->current = (uint8_t*)malloc(len);
-	null_check(ba->data);
     memcpy(ba->data, buf->current, len);
     buf->current += len;
     return ba;
 }
 
+// like serial_decode_string, but borrows the bytes from buf instead of copying them
+struct byte_array* serial_decode_view(struct byte_array* buf)
+{
+	null_check(buf);
+    int32_t len = serial_decode_int(buf);
+	assert_message(len>=0, "negative length");
+    struct byte_array* ba = byte_array_view(buf->current, len);
+    buf->current += len;
+    return ba;
+}
+
+// like serial_decode_view, but the result keeps buf's bytes allocated
+struct byte_array* serial_decode_slice(struct byte_array* buf)
+{
+	null_check(buf);
+    int32_t len = serial_decode_int(buf);
+	assert_message(len >= 0 && len <= buf->data + buf->length - buf->current, "bad length");
+    struct byte_array* ba = byte_array_slice(buf, buf->current - buf->data, len);
+    buf->current += len;
+    return ba;
+}
+
 void serial_decode(struct byte_array* buf, serial_element se, const void* extra)
 {
     while (buf->current < buf->data + buf->length)
@@ -128,11 +148,9 @@ void serial_decode(struct byte_array* buf, serial_element se, const void* extra)
 struct byte_array *encode_float(struct byte_array *buf, float f)
 {
     assert_message(sizeof(float)==4, "bad float size");
-    uint8_t *uf = (uint8_t*)&f;
-    for (int i=4; i; i--) {
-        byte_array_add_byte(buf, *uf);
-        uf++;
-    }
+    byte_array_resize(buf, buf->length + sizeof(float));
+    memcpy(buf->data + buf->length - sizeof(float), &f, sizeof(float));
+    buf->current = buf->data + buf->length;
     return buf;
 }
 
@@ -166,6 +184,203 @@ struct byte_array* serial_encode_string(struct byte_array* buf, const struct byt
     return buf;
 }
 
+// compression /////////////////////////////////////////////////////////////
+//
+// A frame is COMPRESSED_MAGIC, the uncompressed length, then blocks of up to
+// LZ_BLOCK bytes, each its length, its compressed length (0 if stored as
+// is) and its bytes. A compressed block is a run of sequences: a token with
+// the literal count in its high nibble and match length - LZ_MATCH in its
+// low one, 15 meaning more follow in bytes until one isn't 255; the literals;
+// then, unless the block ends, a two byte offset back to the match.
+
+#define LZ_BLOCK        65536   // so offsets fit in two bytes
+#define LZ_MATCH        4       // shortest match
+#define LZ_HASH_BITS    13
+#define LZ_BOUND(n)     ((n) + (n) / 255 + 16)
+
+static inline uint32_t lz_hash(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+static uint8_t *lz_length(uint8_t *out, uint32_t n)
+{
+    for (; n >= 255; n -= 255)
+        *out++ = 255;
+    *out++ = (uint8_t)n;
+    return out;
+}
+
+static uint8_t *lz_sequence(uint8_t *out, const uint8_t *literals, uint32_t n,
+                            uint32_t offset, uint32_t match)
+{
+    uint32_t extra = match ? match - LZ_MATCH : 0;
+    *out++ = (uint8_t)((n < 15 ? n : 15) << 4 | (extra < 15 ? extra : 15));
+    if (n >= 15)
+        out = lz_length(out, n - 15);
+    memcpy(out, literals, n);
+    out += n;
+    if (!match)
+        return out;
+    *out++ = (uint8_t)offset;
+    *out++ = (uint8_t)(offset >> 8);
+    if (extra >= 15)
+        out = lz_length(out, extra - 15);
+    return out;
+}
+
+// compresses n bytes into out, which has room for LZ_BOUND(n); returns the length
+static uint32_t lz_block(const uint8_t *in, uint32_t n, uint8_t *out, uint32_t *table)
+{
+    memset(table, 0, sizeof(uint32_t) << LZ_HASH_BITS);
+    uint8_t *start = out;
+    uint32_t anchor = 0, i = 0;
+    while (i + LZ_MATCH <= n) {
+        uint32_t h = lz_hash(in + i);
+        uint32_t candidate = table[h]; // position + 1
+        table[h] = i + 1;
+        if (!candidate || memcmp(in + candidate - 1, in + i, LZ_MATCH)) {
+            i += 1 + ((i - anchor) >> 6); // skip faster through what doesn't compress
+            continue;
+        }
+        uint32_t from = candidate - 1, match = LZ_MATCH;
+        while (i + match < n && in[from + match] == in[i + match])
+            match++;
+        out = lz_sequence(out, in + anchor, i - anchor, i - from, match);
+        i += match;
+        anchor = i;
+    }
+    out = lz_sequence(out, in + anchor, n - anchor, 0, 0);
+    return (uint32_t)(out - start);
+}
+
+static bool lz_count(const uint8_t **in, const uint8_t *end, uint32_t *n)
+{
+    uint8_t b;
+    do {
+        if (*in >= end)
+            return false;
+        b = *(*in)++;
+        *n += b;
+    } while (b == 255);
+    return true;
+}
+
+// decompresses a block of n bytes into exactly size bytes
+static bool lz_unblock(const uint8_t *in, uint32_t n, uint8_t *out, uint32_t size)
+{
+    const uint8_t *end = in + n;
+    uint8_t *o = out, *o_end = out + size;
+    while (in < end) {
+        uint8_t token = *in++;
+        uint32_t literals = token >> 4;
+        if (literals == 15 && !lz_count(&in, end, &literals))
+            return false;
+        if (literals > (uint32_t)(end - in) || literals > (uint32_t)(o_end - o))
+            return false;
+        memcpy(o, in, literals);
+        in += literals;
+        o += literals;
+        if (in == end)
+            break;
+
+        if (end - in < 2)
+            return false;
+        uint32_t offset = in[0] | in[1] << 8;
+        in += 2;
+        uint32_t match = token & 15;
+        if (match == 15 && !lz_count(&in, end, &match))
+            return false;
+        match += LZ_MATCH;
+        if (!offset || offset > (uint32_t)(o - out) || match > (uint32_t)(o_end - o))
+            return false;
+        const uint8_t *from = o - offset;
+        for (uint32_t copied = 0, span = offset; copied < match; span *= 2) {
+            uint32_t k = match - copied < span ? match - copied : span; // overlaps repeat
+            memcpy(o + copied, from, k);
+            copied += k;
+        }
+        o += match;
+    }
+    return o == o_end;
+}
+
+// appends a compressed frame of raw to buf
+struct byte_array *serial_compress(struct byte_array *buf, const struct byte_array *raw)
+{
+    if (!buf)
+        buf = byte_array_new();
+    byte_array_add_byte(buf, COMPRESSED_MAGIC);
+    encode_int(buf, raw->length);
+    uint32_t *table = (uint32_t*)malloc(sizeof(uint32_t) << LZ_HASH_BITS);
+    uint8_t *packed = (uint8_t*)malloc(LZ_BOUND(LZ_BLOCK));
+    assert_message(table && packed, ERROR_ALLOC);
+
+    for (uint32_t at = 0; at < raw->length; at += LZ_BLOCK) {
+        uint32_t n = raw->length - at < LZ_BLOCK ? raw->length - at : LZ_BLOCK;
+        uint32_t m = lz_block(raw->data + at, n, packed, table);
+        bool stored = m >= n;
+        encode_int(buf, n);
+        encode_int(buf, stored ? 0 : m);
+        uint32_t offset = buf->length;
+        byte_array_resize(buf, offset + (stored ? n : m));
+        memcpy(buf->data + offset, stored ? raw->data + at : packed, stored ? n : m);
+        buf->current = buf->data + buf->length;
+    }
+    free(table);
+    free(packed);
+    return buf;
+}
+
+// whether an int ends before end, so serial_decode_int stays in bounds
+static bool lz_int_ready(const struct byte_array *buf)
+{
+    const uint8_t *end = buf->data + buf->length;
+    for (const uint8_t *p = buf->current; p < end; p++)
+        if (!(*p & 0x80) || p - buf->current == 4)
+            return true;
+    return false;
+}
+
+// decompresses the frame at buf's current position, or returns NULL if it isn't one
+struct byte_array *serial_decompress(struct byte_array *buf)
+{
+    null_check(buf);
+    const uint8_t *end = buf->data + buf->length;
+    if (buf->current >= end || *buf->current != COMPRESSED_MAGIC)
+        return NULL;
+    buf->current++;
+    if (!lz_int_ready(buf))
+        return NULL;
+    int32_t length = serial_decode_int(buf);
+    if (length < 0)
+        return NULL;
+
+    // grows as blocks check out, so a frame can't claim more than it holds
+    struct byte_array *raw = byte_array_new_size(length < LZ_BLOCK ? length : LZ_BLOCK);
+    uint32_t at = 0;
+    while (at < (uint32_t)length) {
+        int32_t n = lz_int_ready(buf) ? serial_decode_int(buf) : -1;
+        int32_t m = lz_int_ready(buf) ? serial_decode_int(buf) : -1;
+        if (n <= 0 || n > LZ_BLOCK || n > length - at || m < 0 || (m ? m : n) > end - buf->current)
+            break;
+        byte_array_resize(raw, at + n);
+        if (!m)
+            memcpy(raw->data + at, buf->current, n);
+        else if (!lz_unblock(buf->current, m, raw->data + at, n))
+            break;
+        buf->current += m ? m : n;
+        at += n;
+    }
+    if (at < (uint32_t)length) {
+        byte_array_del(raw);
+        return NULL;
+    }
+    return raw;
+}
+
 #ifdef DEBUG
 
 bool display_serial(const struct key_value_pair* kvp) {
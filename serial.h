@@ -60,4 +60,14 @@ float serial_decode_float(struct byte_array* buf);
 
 struct byte_array* serial_decode_string(struct byte_array* buf);
 
+struct byte_array* serial_decode_view(struct byte_array* buf);
+
+struct byte_array* serial_decode_slice(struct byte_array* buf);
+
+#define COMPRESSED_MAGIC 0x7e // starts a compressed frame; reads as a negative int
+
+struct byte_array *serial_compress(struct byte_array *buf, const struct byte_array *raw);
+
+struct byte_array *serial_decompress(struct byte_array *buf);
+
 #endif // SERIAL_H
@@ -9,16 +9,25 @@
 #include <stdarg.h>
 #include <assert.h>
 #include <ctype.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "vm.h"
 #include "struct.h"
 #include "util.h"
 
-#define BYTE_ARRAY_MAX_LEN      10000
+#define BYTE_ARRAY_MIN_SIZE     16
 #define ERROR_BYTE_ARRAY_LEN    "byte array too long"
 
 
 // array ///////////////////////////////////////////////////////////////////
+//
+// Grows geometrically at either end: capacity counts slots allocated from
+// data onwards and front counts free slots allocated before data. Up to
+// ARRAY_SMALL elements live inline in the struct, with no second malloc.
+
+#define ARRAY_MIN_SIZE  8
 
 struct array *array_new() {
     return array_new_size(0);
@@ -26,38 +35,97 @@ struct array *array_new() {
 
 struct array *array_new_size(uint32_t size) {
     struct array *a = (struct array*)malloc(sizeof(struct array));
-    a->data = NULL;
+    assert_message(a, ERROR_ALLOC);
+    if (size <= ARRAY_SMALL) {
+        a->data = a->small;
+        size = ARRAY_SMALL;
+    } else {
+        a->data = (void**)malloc(size * sizeof(void*));
+        assert_message(a->data, ERROR_ALLOC);
+    }
     a->current = a->length = 0;
+    a->capacity = size;
+    a->front = 0;
     return a;
 }
 
+static inline bool array_small(const struct array *a) {
+    return a->data - a->front == a->small;
+}
+
 void array_del(struct array *a) {
     for (int i=0; i<a->length; i++)
         free(array_get(a, i));
-    free(a->data);
+    if (!array_small(a))
+        free(a->data - a->front);
     free(a);
 }
 
+// room for at least size elements from data onwards
+static void array_reserve(struct array *a, uint32_t size)
+{
+    if (size <= a->capacity)
+        return;
+    uint32_t grown = a->capacity > ARRAY_MIN_SIZE / 2 ? a->capacity * 2 : ARRAY_MIN_SIZE;
+    if (grown < size)
+        grown = size;
+    void **base;
+    if (array_small(a)) { // spill to the heap
+        base = (void**)malloc((a->front + grown) * sizeof(void*));
+        assert_message(base, ERROR_ALLOC);
+        memcpy(base + a->front, a->data, a->length * sizeof(void*));
+    } else {
+        base = (void**)realloc(a->data - a->front, (a->front + grown) * sizeof(void*));
+        assert_message(base, ERROR_ALLOC);
+    }
+    a->data = base + a->front;
+    a->capacity = grown;
+}
+
+// room for at least one more element before data
+static void array_reserve_front(struct array *a)
+{
+    if (a->front)
+        return;
+    uint32_t front = a->length > ARRAY_MIN_SIZE ? a->length : ARRAY_MIN_SIZE;
+    void **base = (void**)malloc((front + a->capacity) * sizeof(void*));
+    assert_message(base, ERROR_ALLOC);
+    if (a->length)
+        memcpy(base + front, a->data, a->length * sizeof(void*));
+    if (!array_small(a))
+        free(a->data);
+    a->data = base + front;
+    a->front = front;
+}
+
 void array_resize(struct array *a, uint32_t length) {
-    a->data = (void**)realloc(a->data, length * sizeof(void*));
-    null_check(a->data);
-    memset(&a->data[a->length], 0, length-a->length);
+    array_reserve(a, length);
+    if (length > a->length)
+        memset(&a->data[a->length], 0, (length - a->length) * sizeof(void*));
     a->length = length;
 }
 
 uint32_t array_add(struct array *a, void *datum) {
-    a->data = (void**)realloc(a->data, (a->length+1) * sizeof(void*));
+    array_reserve(a, a->length + 1);
     a->data[a->length++] = datum;
     return a->length-1;
 }
 
 void array_insert(struct array *a, uint32_t index, void *datum)
 {
-    a->data = (void**)realloc(a->data, (a->length+1) * sizeof(void*));
-    uint32_t i;
-    for (i=a->length; i>index; i--)
-        a->data[i] = a->data[i-1];
-    a->data[i] = datum;
+    assert_message(index <= a->length, ERROR_INDEX);
+    if (!index && array_small(a) && a->length < a->capacity) { // shift in place
+        memmove(&a->data[1], a->data, a->length * sizeof(void*));
+    } else if (!index) { // building right to left
+        array_reserve_front(a);
+        a->data--;
+        a->front--;
+        a->capacity++;
+    } else {
+        array_reserve(a, a->length + 1);
+        memmove(&a->data[index+1], &a->data[index], (a->length - index) * sizeof(void*));
+    }
+    a->data[index] = datum;
     a->length++;
 }
 
@@ -76,28 +144,33 @@ void array_set(struct array *a, uint32_t index, void* datum) {
     a->data[index] = datum;
 }
 
-void *list_remove(void *data, uint32_t *end, uint32_t start, int32_t length, size_t width)
+// shifts out length elements at start, or all after start if length is negative
+static uint32_t list_remove(void *data, uint32_t end, uint32_t start, int32_t length, size_t width)
 {
-    assert_message(data || !length, "list can't remove");
-    null_check(end);
-    length = length < 0 ? *end - start : length;
-    assert_message(!length || (start < *end && start+length <= *end), "index out of bounds");
-
-    memmove((uint8_t*)data+start*width, (uint8_t*)data+(start+length)*width, (*end-start-length)*width);
-    *end -= (uint32_t)length;
-    return realloc(data, *end * width);
+    length = length < 0 ? end - start : length;
+    assert_message(!length || (start < end && start+length <= end), "index out of bounds");
+    if (length)
+        memmove((uint8_t*)data+start*width, (uint8_t*)data+(start+length)*width, (end-start-length)*width);
+    return end - (uint32_t)length;
 }
 
 void array_remove(struct array *self, uint32_t start, int32_t length) {
-    self->data = (void**)list_remove(self->data, &self->length, start, length, sizeof(void*));
+    if (!start && length > 0 && length <= self->length) { // from the front; keep the room
+        self->data += length;
+        self->front += length;
+        self->capacity -= length;
+        self->length -= length;
+        return;
+    }
+    self->length = list_remove(self->data, self->length, start, length, sizeof(void*));
 }
 
 struct array *array_copy(const struct array* original) {
     if (!original)
         return NULL;
-    struct array* copy = (struct array*)malloc(sizeof(struct array));
-    copy->data = (void**)malloc(original->length * sizeof(void**));
-    memcpy(copy->data, original->data, original->length * sizeof(void*));
+    struct array* copy = array_new_size(original->length);
+    if (original->length)
+        memcpy(copy->data, original->data, original->length * sizeof(void*));
     copy->length = original->length;
     copy->current = original->current;
     return copy;
@@ -105,9 +178,11 @@ struct array *array_copy(const struct array* original) {
 
 struct array *array_part(struct array *within, uint32_t start, uint32_t length)
 {
-    struct array *p = array_copy(within);
-    array_remove(p, start+length, within->length-start-length);
-    array_remove(p, 0, start);
+    assert_message(start <= within->length && length <= within->length - start, ERROR_INDEX);
+    struct array *p = array_new_size(length);
+    if (length)
+        memcpy(p->data, within->data + start, length * sizeof(void*));
+    p->length = length;
     return p;
 }
 
@@ -117,7 +192,8 @@ void array_append(struct array *a, const struct array* b)
     null_check(b);
     uint32_t alen = a->length;
     array_resize(a, alen + b->length);
-    memcpy(&a->data[alen], b->data, b->length * sizeof(void*));
+    if (b->length)
+        memcpy(&a->data[alen], b->data, b->length * sizeof(void*));
     a->current += b->length;
 }
 
@@ -126,29 +202,89 @@ void array_append(struct array *a, const struct array* b)
 struct byte_array *byte_array_new() {
     struct byte_array* ba = (struct byte_array*)malloc(sizeof(struct byte_array));
     ba->data = ba->current = 0;
-    ba->length = 0;
+    ba->length = ba->capacity = 0;
+    ba->view = false;
+    ba->shared = NULL;
+    ba->interned = false;
+    ba->hash = 0;
     return ba;
 }
 
 void byte_array_del(struct byte_array* ba) {
-    if (ba->data)
+    if (ba->interned)
+        return;
+    if (ba->shared && --ba->shared->refs) {
+        free(ba);
+        return;
+    }
+    if (ba->shared)
+        free(ba->shared->base);
+    else if (ba->data && !ba->view)
         free(ba->data);
+    free(ba->shared);
     free(ba);
 }
 
 struct byte_array *byte_array_new_size(uint32_t size) {
     struct byte_array* ba = (struct byte_array*)malloc(sizeof(struct byte_array));
     ba->data = ba->current = (uint8_t*)malloc(size);
-    ba->length = size;
+    assert_message(ba->data || !size, ERROR_ALLOC);
+    ba->length = ba->capacity = size;
+    ba->view = false;
+    ba->shared = NULL;
+    ba->interned = false;
+    ba->hash = 0;
+    return ba;
+}
+
+// wraps bytes owned by someone else, which must outlive the view
+struct byte_array *byte_array_view(uint8_t *data, uint32_t length) {
+    struct byte_array* ba = byte_array_new();
+    ba->data = ba->current = data;
+    ba->length = length;
+    ba->view = true;
     return ba;
 }
 
+// copies borrowed or shared bytes before they are changed
+void byte_array_own(struct byte_array *ba)
+{
+    assert_message(!ba->interned, "changing interned bytes");
+    if (ba->shared && ba->shared->refs == 1 && ba->data == ba->shared->base) { // the others are gone
+        ba->capacity = ba->shared->size;
+        free(ba->shared);
+        ba->shared = NULL;
+    }
+    if (!ba->view && !ba->shared)
+        return;
+    uint8_t *data = (uint8_t*)malloc(ba->length);
+    assert_message(data || !ba->length, ERROR_ALLOC);
+    memcpy(data, ba->data, ba->length);
+    if (ba->shared && !--ba->shared->refs) { // the last slice of it
+        free(ba->shared->base);
+        free(ba->shared);
+    }
+    ba->current = data + (ba->current - ba->data);
+    ba->data = data;
+    ba->capacity = ba->length;
+    ba->view = false;
+    ba->hash = 0; // about to change
+    ba->shared = NULL;
+}
+
 void byte_array_resize(struct byte_array* ba, uint32_t size) {
     assert_message(ba->current >= ba->data, "byte_array corrupt");
-    uint32_t delta = ba->current - ba->data;
-    ba->data = (uint8_t*)realloc(ba->data, size);
-    assert(ba->data);
-    ba->current = ba->data + delta;
+    byte_array_own(ba);
+    if (size > ba->capacity) {
+        uint32_t grown = ba->capacity > BYTE_ARRAY_MIN_SIZE / 2 ? ba->capacity * 2 : BYTE_ARRAY_MIN_SIZE;
+        if (grown < size || grown < ba->capacity) // or overflowed
+            grown = size;
+        uint32_t delta = ba->current - ba->data;
+        ba->data = (uint8_t*)realloc(ba->data, grown);
+        assert_message(ba->data, ERROR_ALLOC);
+        ba->current = ba->data + delta;
+        ba->capacity = grown;
+    }
     ba->length = size;
 }
 
@@ -169,15 +305,60 @@ struct byte_array *byte_array_copy(const struct byte_array* original) {
     struct byte_array* copy = (struct byte_array*)malloc(sizeof(struct byte_array));
     copy->data = (uint8_t*)malloc(original->length);
     memcpy(copy->data, original->data, original->length);
-    copy->length = original->length;
+    copy->length = copy->capacity = original->length;
     copy->current = copy->data + (original->current - original->data);
+    copy->view = false;
+    copy->shared = NULL;
+    copy->interned = false;
+    copy->hash = 0;
+    return copy;
+}
+
+static struct byte_share *byte_share_new(uint8_t *base, uint32_t size, uint32_t used)
+{
+    struct byte_share *shared = (struct byte_share*)malloc(sizeof(struct byte_share));
+    assert_message(shared, ERROR_ALLOC);
+    shared->base = base;
+    shared->refs = 1;
+    shared->size = size;
+    shared->used = used;
+    return shared;
+}
+
+// a copy that shares data with the original until either changes
+struct byte_array *byte_array_share(struct byte_array* original) {
+    if (!original)
+        return NULL;
+    if (!original->view && !original->shared)
+        original->shared = byte_share_new(original->data, original->length, original->length);
+    struct byte_array* copy = (struct byte_array*)malloc(sizeof(struct byte_array));
+    *copy = *original;
+    copy->interned = false;
+    if (copy->shared)
+        copy->shared->refs++;
     return copy;
 }
 
+// a handle on part of within's bytes, which stay allocated while it lives;
+// a slice of borrowed bytes borrows them too
+struct byte_array *byte_array_slice(struct byte_array *within, uint32_t start, uint32_t length)
+{
+    null_check(within);
+    assert_message(start <= within->length && length <= within->length - start, ERROR_INDEX);
+    if (within->view || within->interned)
+        return byte_array_view(within->data + start, length);
+    struct byte_array *slice = byte_array_share(within);
+    slice->data = slice->current = within->data + start;
+    slice->length = length;
+    slice->hash = 0;
+    return slice;
+}
+
 void byte_array_set(struct byte_array *within, uint32_t index, uint8_t byte)
 {
     null_check(within);
     assert_message(index < within->length, "out of bounds");
+    byte_array_own(within);
     within->data[index] = byte;
 }
 
@@ -198,7 +379,8 @@ void byte_array_append(struct byte_array *a, const struct byte_array* b) {
 }
 
 void byte_array_remove(struct byte_array *self, uint32_t start, int32_t length) {
-    self->data = (uint8_t*)list_remove(self->data, &self->length, start, length, sizeof(uint8_t));
+    byte_array_own(self);
+    self->length = list_remove(self->data, self->length, start, length, sizeof(uint8_t));
 }
 
 struct byte_array *byte_array_part(struct byte_array *within, uint32_t start, uint32_t length)
@@ -239,7 +421,7 @@ struct byte_array *byte_array_concatenate(int n, const struct byte_array* ba, ..
         struct byte_array* parameter = va_arg(argp, struct byte_array* );
         if (!parameter)
             continue;
-        assert_message(result->length + parameter->length < BYTE_ARRAY_MAX_LEN, ERROR_BYTE_ARRAY_LEN);
+        assert_message(result->length + parameter->length >= result->length, ERROR_BYTE_ARRAY_LEN);
         byte_array_append(result, parameter);
     }
 
@@ -250,6 +432,40 @@ struct byte_array *byte_array_concatenate(int n, const struct byte_array* ba, ..
     return result;
 }
 
+// a followed by b, written into the room after a's data unless another byte_array
+// already uses it, so that s = s + piece in a loop takes linear time
+struct byte_array *byte_array_join(struct byte_array *a, const struct byte_array *b)
+{
+    null_check(a);
+    null_check(b);
+    uint32_t length = a->length + b->length;
+    assert_message(length >= a->length, ERROR_BYTE_ARRAY_LEN);
+
+    struct byte_share *shared = a->shared;
+    if (shared && a->data == shared->base && shared->used == a->length && shared->size >= length) {
+        struct byte_array *joined = byte_array_share(a);
+        memcpy(joined->data + a->length, b->data, b->length);
+        joined->length = shared->used = length;
+        joined->current = joined->data + length;
+        return joined;
+    }
+
+    // start a buffer with room to grow
+    uint32_t size = length < UINT32_MAX / 2 ? length * 2 : UINT32_MAX;
+    if (size < BYTE_ARRAY_MIN_SIZE)
+        size = BYTE_ARRAY_MIN_SIZE;
+    struct byte_array *joined = byte_array_new();
+    joined->data = (uint8_t*)malloc(size);
+    assert_message(joined->data, ERROR_ALLOC);
+    memcpy(joined->data, a->data, a->length);
+    memcpy(joined->data + a->length, b->data, b->length);
+    joined->length = length;
+    joined->capacity = size;
+    joined->current = joined->data + length;
+    joined->shared = byte_share_new(joined->data, size, length);
+    return joined;
+}
+
 struct byte_array *byte_array_add_byte(struct byte_array *a, uint8_t b) {
     byte_array_resize(a, a->length+1);
     a->current = a->data + a->length;
@@ -265,6 +481,8 @@ void byte_array_print(char* into, size_t size, const struct byte_array* ba) {
         sprintf(into+(i+1)*2, "%02X", ba->data[i]);
 }
 
+// candidates must match sought's first and last bytes, which SSE2 checks
+// sixteen at a time, and memchr scans for otherwise
 int32_t byte_array_find(struct byte_array *within, struct byte_array *sought, uint32_t start)
 {
     null_check(within);
@@ -272,18 +490,79 @@ int32_t byte_array_find(struct byte_array *within, struct byte_array *sought, ui
 
     uint32_t ws = within->length;
     uint32_t ss = sought->length;
-    if (start + ss >= within->length)
+    if (start > ws || ss > ws - start)
         return -1;
+    if (!ss)
+        return start;
+
+    const uint8_t *wd = within->data;
+    const uint8_t *sd = sought->data;
+    const uint8_t *p = wd + start;
+    const uint8_t *last = wd + ws - ss; // the last place a match can begin
+    uint8_t first = sd[0], final = sd[ss-1];
+
+#ifdef __SSE2__
+    if (ss > 1) {
+        __m128i f = _mm_set1_epi8((char)first);
+        __m128i l = _mm_set1_epi8((char)final);
+        for (; last - p >= 15; p += 16) {
+            __m128i a = _mm_loadu_si128((const __m128i*)p);
+            __m128i b = _mm_loadu_si128((const __m128i*)(p + ss - 1));
+            uint32_t mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, f), _mm_cmpeq_epi8(b, l)));
+            for (; mask; mask &= mask - 1) {
+                const uint8_t *q = p + __builtin_ctz(mask);
+                if (!memcmp(q + 1, sd + 1, ss - 2))
+                    return (int32_t)(q - wd);
+            }
+        }
+    }
+#endif
 
-    uint8_t *wd = within->data;
-    uint8_t *sd = sought->data;
-    for (int32_t i=start; i<ws-ss+1; i++)
-        if (!memcmp(wd + i, sd, ss)) 
-            return i; 
-
+    for (; p <= last && (p = (const uint8_t*)memchr(p, first, last - p + 1)); p++)
+        if (p[ss-1] == final && !memcmp(p + 1, sd + 1, ss > 1 ? ss - 2 : 0))
+            return (int32_t)(p - wd);
     return -1;
 }
 
+// replaces every match, finding them all first to allocate the result once
+struct byte_array *byte_array_replace_all(struct byte_array *within, struct byte_array *sought, struct byte_array *replacement)
+{
+    null_check(within);
+    null_check(sought);
+    null_check(replacement);
+    assert_message(sought->length, "replacing an empty string");
+
+    uint32_t *found = NULL, count = 0, room = 0;
+    for (int32_t at = 0; (at = byte_array_find(within, sought, at)) >= 0; at += sought->length) {
+        if (count == room) {
+            room = room ? room * 2 : 16;
+            found = (uint32_t*)realloc(found, room * sizeof(uint32_t));
+            null_check(found);
+        }
+        found[count++] = (uint32_t)at;
+    }
+    if (!count)
+        return byte_array_share(within);
+
+    int64_t length = (int64_t)within->length + (int64_t)count * ((int64_t)replacement->length - sought->length);
+    assert_message(length <= UINT32_MAX, ERROR_BYTE_ARRAY_LEN);
+    struct byte_array *replaced = byte_array_new_size((uint32_t)length);
+
+    uint8_t *out = replaced->data;
+    uint32_t from = 0;
+    for (uint32_t i=0; i<count; i++) {
+        memcpy(out, within->data + from, found[i] - from);
+        out += found[i] - from;
+        memcpy(out, replacement->data, replacement->length);
+        out += replacement->length;
+        from = found[i] + sought->length;
+    }
+    memcpy(out, within->data + from, within->length - from);
+
+    free(found);
+    return replaced;
+}
+
 struct byte_array *byte_array_replace(struct byte_array *within, struct byte_array *replacement, uint32_t start, int32_t length)
 {
     null_check(within);
@@ -306,81 +585,191 @@ struct byte_array *byte_array_replace(struct byte_array *within, struct byte_arr
 
 // stack ////////////////////////////////////////////////////////////////////
 
+#define STACK_MIN_SIZE  16
+
 struct stack* stack_new() {
     return (struct stack*)calloc(sizeof(struct stack), 1);
 }
 
-struct stack_node* stack_node_new() {
-    return (struct stack_node*)calloc(sizeof(struct stack_node), 1);
+void stack_del(struct stack *stack)
+{
+    free(stack->data);
+    free(stack);
 }
 
-uint32_t stack_depth(struct stack *stack)
+// make room for at least size items, so pushes up to that depth never reallocate
+void stack_reserve(struct stack *stack, uint32_t size)
 {
-    uint32_t i;
-    struct stack_node *sn = stack->head;
-    for (i=0; sn; i++, sn=sn->next);
-    return i;
+    if (size <= stack->size)
+        return;
+    uint32_t grown = stack->size ? stack->size : STACK_MIN_SIZE;
+    while (grown < size)
+        grown *= 2;
+    stack->data = (void**)realloc(stack->data, grown * sizeof(void*));
+    null_check(stack->data);
+    stack->size = grown;
+}
+
+uint32_t stack_depth(const struct stack *stack) {
+    return stack->depth;
 }
 
 void stack_push(struct stack* stack, void* data)
 {
     null_check(data);
-    if (!stack->head)
-        stack->head = stack->tail = stack_node_new();
-    else {
-        struct stack_node* old_head = stack->head;
-        stack->head = stack_node_new();
-        null_check(stack->head);
-        stack->head->next = old_head;
-    }
-    stack->head->data = data;
-    //DEBUGPRINT("stack_push %x to %x:%d\n", data, stack, stack_depth(stack));
+    if (stack->depth == stack->size)
+        stack_reserve(stack, stack->depth + 1);
+    stack->data[stack->depth++] = data;
+    //DEBUGPRINT("stack_push %x to %x:%d\n", data, stack, stack->depth);
+}
+
+// pushes into room already made by stack_reserve, without checking for it
+void stack_push_reserved(struct stack* stack, void* data)
+{
+#ifdef DEBUG
+    assert_message(stack->depth < stack->size, "stack push past reserve");
+#endif
+    stack->data[stack->depth++] = data;
 }
 
 void* stack_pop(struct stack* stack)
 {
-    if (!stack->head)
+    if (!stack->depth)
         return NULL;
-    void* data = stack->head->data;
-    stack->head = stack->head->next;
+    void* data = stack->data[--stack->depth];
     null_check(data);
-    //DEBUGPRINT("stack_pop %x from %x:%d\n", data, stack, stack_depth(stack));
+    //DEBUGPRINT("stack_pop %x from %x:%d\n", data, stack, stack->depth);
     return data;
 }
 
 void* stack_peek(const struct stack* stack, uint8_t index)
 {
     null_check(stack);
-    struct stack_node *p = stack->head;
-    for (; index && p; index--, p=p->next);
-    return p ? p->data : NULL;
+    return index < stack->depth ? stack->data[stack->depth - 1 - index] : NULL;
 }
 
 bool stack_empty(const struct stack* stack)
 {
     null_check(stack);
-    return stack->head == NULL;
+    return !stack->depth;
 }
 
 // map /////////////////////////////////////////////////////////////////////
+//
+// Open addressing in the style of a Swiss table: each slot has a control
+// byte holding 7 bits of its hash, or marking it empty or deleted, and a
+// probe tests eight control bytes at once as one 64-bit word. Slots index
+// a dense array of entries kept in insertion order, which is the order of
+// iteration.
+
+#define MAP_GROUP       8       // control bytes tested at once
+#define MAP_MIN_SIZE    16
+#define MAP_EMPTY       0x80
+#define MAP_DELETED     0xFE
+#define MAP_LOWS        0x0101010101010101ULL
+#define MAP_HIGHS       0x8080808080808080ULL
+
+#define HASH_PRIME1     0x9E3779B185EBCA87ULL
+#define HASH_PRIME2     0xC2B2AE3D27D4EB4FULL
+#define HASH_PRIME3     0x165667B19E3779F9ULL
+
+static inline uint64_t rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
 
+// eight bytes at a time, then a full avalanche, after xxh64
 static int32_t default_hashor(const void *x)
 {
     const struct byte_array *key = (const struct byte_array*)x;
-    int32_t hash = 0;
-    int i = 0;
-    for (i = 0; i<key->length; i++)
-        hash += key->data[i];
-    return hash;
+    if (key->interned || (key->view && key->hash))
+        return key->hash;
+
+    const uint8_t *p = key->data;
+    uint32_t n = key->length;
+    uint64_t hash = HASH_PRIME3 + n;
+    for (; n >= 8; p += 8, n -= 8) {
+        uint64_t word;
+        memcpy(&word, p, 8);
+        hash ^= rotl64(word * HASH_PRIME2, 31) * HASH_PRIME1;
+        hash = rotl64(hash, 27) * HASH_PRIME1 + HASH_PRIME3;
+    }
+    for (; n; p++, n--)
+        hash = rotl64(hash ^ (*p * HASH_PRIME3), 11) * HASH_PRIME1;
+
+    hash ^= hash >> 33;
+    hash *= HASH_PRIME2;
+    hash ^= hash >> 29;
+    hash *= HASH_PRIME3;
+    hash ^= hash >> 32;
+    return (int32_t)hash;
+}
+
+// spreads weak hashes, such as pointers, across all 32 bits
+static inline uint32_t map_mix(int32_t h)
+{
+    uint32_t x = (uint32_t)h;
+    x ^= x >> 16;
+    x *= 0x85EBCA6B;
+    x ^= x >> 13;
+    x *= 0xC2B2AE35;
+    x ^= x >> 16;
+    return x;
+}
+
+static inline uint8_t map_h2(uint32_t hash) { return hash & 0x7F; }
+static inline uint32_t map_h1(uint32_t hash) { return hash >> 7; }
+
+// control bytes at i, the first in the lowest byte
+static inline uint64_t map_group(const struct map *m, uint32_t i)
+{
+    const uint8_t *c = m->ctrl + i;
+    uint64_t group = 0;
+    for (int b=MAP_GROUP-1; b>=0; b--)
+        group = (group << 8) | c[b];
+    return group;
+}
+
+// high bit set in each byte of group equal to h2; may rarely flag a neighbour
+static inline uint64_t map_match(uint64_t group, uint8_t h2)
+{
+    uint64_t x = group ^ (MAP_LOWS * h2);
+    return (x - MAP_LOWS) & ~x & MAP_HIGHS;
+}
+
+static inline uint64_t map_match_empty(uint64_t group) {
+    return group & ~(group << 6) & MAP_HIGHS;
 }
 
-static bool default_comparator(const void *a, const void *b) {
-    return byte_array_equals((struct byte_array*)a, (struct byte_array*)b);
+static inline uint64_t map_match_free(uint64_t group) { // empty or deleted
+    return group & MAP_HIGHS;
+}
+
+static inline uint32_t map_first(uint64_t match) {
+    return __builtin_ctzll(match) / 8;
+}
+
+static void map_set_ctrl(struct map *m, uint32_t i, uint8_t c)
+{
+    m->ctrl[i] = c;
+    if (i < MAP_GROUP) // mirrored past the end, so that groups can be read without wrapping
+        m->ctrl[m->size + i] = c;
+}
+
+static bool default_comparator(const void *a, const void *b)
+{
+    const struct byte_array *x = (const struct byte_array*)a;
+    const struct byte_array *y = (const struct byte_array*)b;
+    if (x == y)
+        return true;
+    if (x->interned && y->interned && x->hash != y->hash)
+        return false;
+    return byte_array_equals(x, y);
 }
 
 static void *default_copyor(const void *key)
 {
-    return byte_array_copy((struct byte_array *)key);
+    const struct byte_array *ba = (const struct byte_array*)key;
+    return ba->interned ? (void*)ba : byte_array_copy(ba);
 }
 
 static void default_rm(const void *key)
@@ -388,18 +777,39 @@ static void default_rm(const void *key)
     byte_array_del((struct byte_array*)key);
 }
 
+// keys a map of size slots may hold before it grows
+static inline uint32_t map_capacity(size_t size) {
+    return size - size / 8;
+}
+
+static bool map_alloc(struct map *m, size_t size)
+{
+    m->ctrl = (uint8_t*)malloc(size + MAP_GROUP);
+    m->slots = (uint32_t*)malloc(size * sizeof(uint32_t));
+    m->entries = (struct map_entry*)malloc(map_capacity(size) * sizeof(struct map_entry));
+    if (!m->ctrl || !m->slots || !m->entries) {
+        free(m->ctrl);
+        free(m->slots);
+        free(m->entries);
+        return false;
+    }
+    memset(m->ctrl, MAP_EMPTY, size + MAP_GROUP);
+    m->size = size;
+    m->length = m->used = 0;
+    return true;
+}
+
 struct map* map_new_ex(map_compare *mc, map_hash *mh, map_copyor *my, map_rm *md)
 {
     //DEBUGPRINT(" (map_new) ");
     struct map *m;
     if (!(m =(struct map*)malloc(sizeof(struct map)))) return NULL;
-    m->size = 16;
     m->hash_func = mh ? mh : &default_hashor;
     m->comparator = mc ? mc : &default_comparator;
     m->deletor = md ? md : & default_rm;
     m->copyor = my ? my : &default_copyor;
 
-    if (!(m->nodes = (struct hash_node**)calloc(m->size, sizeof(struct hash_node*)))) {
+    if (!map_alloc(m, MAP_MIN_SIZE)) {
         free(m);
         return NULL;
     }
@@ -411,23 +821,30 @@ struct map* map_new() {
     return map_new_ex(NULL, NULL, NULL, NULL);
 }
 
+// the copy of ba kept in table, which maps hash once, match by pointer and store without copying
+struct byte_array *byte_array_intern(struct map *table, const struct byte_array *ba)
+{
+    if (ba->interned)
+        return (struct byte_array*)ba;
+    struct byte_array *interned = (struct byte_array*)map_get(table, ba);
+    if (interned)
+        return interned;
+    interned = byte_array_copy(ba);
+    interned->hash = default_hashor(interned);
+    interned->interned = true;
+    map_insert(table, interned, interned);
+    return interned;
+}
+
 void map_del(struct map *m)
 {
     DEBUGPRINT("map_destroy\n");
-    size_t n;
-    struct hash_node *node, *oldnode;
-
-    for(n = 0; n<m->size; ++n) {
-        node = m->nodes[n];
-        while (node) {
-            m->deletor(node->key);
-            // byte_array_del(node->key);
-            oldnode = node;
-            node = node->next;
-            free(oldnode);
-        }
-    }
-    free(m->nodes);
+    for (uint32_t i=0; i<m->used; i++)
+        if (!m->entries[i].removed)
+            m->deletor(m->entries[i].key);
+    free(m->ctrl);
+    free(m->slots);
+    free(m->entries);
     free(m);
 }
 
@@ -436,126 +853,153 @@ bool map_key_equals(const struct map *m1, const void *key1, const void *key2)
     return m1->comparator(key1, key2);
 }
 
-int map_insert(struct map *m, const void *key, void *data)
+// index of key's slot, or -1
+static int64_t map_find(const struct map *m, const void *key, uint32_t hash)
 {
-    struct hash_node *node;
-    int32_t hash = m->hash_func(key) % m->size;
-
-    node = m->nodes[hash];
-    while (node) {
-        if (map_key_equals(m, node->key, key)) {
-            node->data = data;
-            return 0;
+    uint32_t mask = m->size - 1;
+    uint8_t h2 = map_h2(hash);
+    for (uint32_t pos = map_h1(hash) & mask, step = 0;; step += MAP_GROUP, pos = (pos + step) & mask) {
+        uint64_t group = map_group(m, pos);
+        for (uint64_t match = map_match(group, h2); match; match &= match - 1) {
+            uint32_t i = (pos + map_first(match)) & mask;
+            const struct map_entry *entry = &m->entries[m->slots[i]];
+            if (entry->hash == hash && map_key_equals(m, entry->key, key))
+                return i;
         }
-        node = node->next;
+        if (map_match_empty(group))
+            return -1;
     }
+}
 
-    if (!(node = (struct hash_node*)malloc(sizeof(struct hash_node))))
-        return -1;
-    //if (!(node->key = byte_array_copy(key))) {
-    if (!(node->key = m->copyor(key))) {
-        free(node);
+// the first empty or deleted slot on the probe sequence for hash
+static uint32_t map_find_free(const struct map *m, uint32_t hash)
+{
+    uint32_t mask = m->size - 1;
+    for (uint32_t pos = map_h1(hash) & mask, step = 0;; step += MAP_GROUP, pos = (pos + step) & mask) {
+        uint64_t match = map_match_free(map_group(m, pos));
+        if (match)
+            return (pos + map_first(match)) & mask;
+    }
+}
+
+static void map_place(struct map *m, uint32_t entry)
+{
+    uint32_t hash = m->entries[entry].hash;
+    uint32_t i = map_find_free(m, hash);
+    map_set_ctrl(m, i, map_h2(hash));
+    m->slots[i] = entry;
+}
+
+// also drops removed entries
+int map_resize(struct map *m, size_t size)
+{
+    DEBUGPRINT("map_resize\n");
+    size_t grown = MAP_MIN_SIZE;
+    while (grown < size || map_capacity(grown) <= m->length)
+        grown *= 2;
+
+    struct map old = *m;
+    if (!map_alloc(m, grown)) {
+        *m = old;
         return -1;
     }
-    node->data = data;
-    node->next = m->nodes[hash];
-    m->nodes[hash] = node;
+    for (uint32_t i=0; i<old.used; i++) {
+        if (old.entries[i].removed)
+            continue;
+        m->entries[m->used] = old.entries[i];
+        map_place(m, m->used++);
+    }
+    m->length = m->used;
+    free(old.ctrl);
+    free(old.slots);
+    free(old.entries);
+    return 0;
+}
+
+int map_insert(struct map *m, const void *key, void *data)
+{
+    uint32_t hash = map_mix(m->hash_func(key));
+    int64_t found = map_find(m, key, hash);
+    if (found >= 0) {
+        m->entries[m->slots[found]].data = data;
+        return 0;
+    }
+
+    if (m->used == map_capacity(m->size)) {
+        size_t size = m->length * 2 < m->size ? m->size : m->size * 2; // mostly removed? just compact
+        if (map_resize(m, size))
+            return -1;
+    }
 
+    void *copy = m->copyor(key);
+    if (!copy)
+        return -1;
+    struct map_entry *entry = &m->entries[m->used];
+    entry->key = copy;
+    entry->data = data;
+    entry->hash = hash;
+    entry->removed = false;
+    map_place(m, m->used++);
+    m->length++;
     return 0;
 }
 
+// the next key and value after *cursor, which starts at 0, in insertion order:
+//     for (uint32_t i=0; map_iter(m, &i, &key, &value);)
+bool map_iter(const struct map *m, uint32_t *cursor, const void **key, void **data)
+{
+    while (*cursor < m->used) {
+        const struct map_entry *entry = &m->entries[(*cursor)++];
+        if (entry->removed || !entry->data)
+            continue;
+        if (key)
+            *key = entry->key;
+        if (data)
+            *data = entry->data;
+        return true;
+    }
+    return false;
+}
+
 struct array* map_keys(const struct map *m) {
     null_check(m);
     struct array *a = array_new();
-    for (int i=0; i<m->size; i++)
-        for (const struct hash_node* n = m->nodes[i]; n; n=n->next)
-            if (n->data)
-                array_add(a, n->key);
+    const void *key;
+    for (uint32_t i=0; map_iter(m, &i, &key, NULL);)
+        array_add(a, (void*)key);
     return a;
 }
 
 struct array* map_values(const struct map *m) {
     struct array *a = array_new();
-    for (int i=0; i<m->size; i++)
-        for (const struct hash_node* n = m->nodes[i]; n; n=n->next)
-            if (n->data)
-                array_add(a, n->data);
+    void *data;
+    for (uint32_t i=0; map_iter(m, &i, NULL, &data);)
+        array_add(a, data);
     return a;
 }
 
 int map_remove(struct map *m, const void *key)
 {
-    struct hash_node *node, *prevnode = NULL;
-    size_t hash = m->hash_func(key)%m->size;
-
-    node = m->nodes[hash];
-    while(node) {
-        if (map_key_equals(m, node->key, key)) {
-            m->deletor(node->key);
-            //byte_array_del(node->key);
-            if (prevnode) prevnode->next = node->next;
-            else m->nodes[hash] = node->next;
-            free(node);
-            return 0;
-        }
-        prevnode = node;
-        node = node->next;
-    }
-    return -1;
+    int64_t found = map_find(m, key, map_mix(m->hash_func(key)));
+    if (found < 0)
+        return -1;
+    struct map_entry *entry = &m->entries[m->slots[found]];
+    m->deletor(entry->key);
+    entry->removed = true;
+    map_set_ctrl(m, (uint32_t)found, MAP_DELETED);
+    m->length--;
+    return 0;
 }
 
 bool map_has(const struct map *m, const void *key)
 {
-    struct hash_node *node;
-    size_t hash = m->hash_func(key) % m->size;
-    node = m->nodes[hash];
-    while (node) {
-        if (map_key_equals(m, node->key, key))
-            return true;
-        node = node->next;
-    }
-    return false;
+    return map_find(m, key, map_mix(m->hash_func(key))) >= 0;
 }
 
 void *map_get(const struct map *m, const void *key)
 {
-    struct hash_node *node;
-    size_t hash = m->hash_func(key) % m->size;
-    node = m->nodes[hash];
-    while (node) {
-        if (map_key_equals(m, node->key, key))
-            return node->data;
-        node = node->next;
-    }
-    return NULL;
-}
-
-int map_resize(struct map *m, size_t size)
-{
-    DEBUGPRINT("map_resize\n");
-    struct map newtbl;
-    size_t n;
-    struct hash_node *node,*next;
-
-    newtbl.size = size;
-    newtbl.hash_func = m->hash_func;
-
-    if (!(newtbl.nodes = (struct hash_node**)calloc(size, sizeof(struct hash_node*))))
-        return -1;
-
-    for (n = 0; n<m->size; ++n) {
-        for(node = m->nodes[n]; node; node = next) {
-            next = node->next;
-            map_insert(&newtbl, node->key, node->data);
-            map_remove(m, node->key);
-        }
-    }
-
-    free(m->nodes);
-    m->size = newtbl.size;
-    m->nodes = newtbl.nodes;
-
-    return 0;
+    int64_t found = map_find(m, key, map_mix(m->hash_func(key)));
+    return found < 0 ? NULL : m->entries[m->slots[found]].data;
 }
 
 // in case of intersection, a wins
@@ -563,12 +1007,11 @@ void map_update(struct map *a, const struct map *b)
 {
     if (b == NULL)
         return;
-    const struct array *keys = map_keys(b);
-    for (int i=0; i<keys->length; i++) {
-        const void *key = array_get(keys, i);
+    const void *key;
+    void *data;
+    for (uint32_t i=0; map_iter(b, &i, &key, &data);)
         if (!map_has(a, key))
-            map_insert(a, key, map_get(b, key));
-    }
+            map_insert(a, key, data);
 }
 
 struct map *map_copy(struct map *original)
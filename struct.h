@@ -18,10 +18,15 @@
 
 // array ///////////////////////////////////////////////////////////////////
 
+#define ARRAY_SMALL 4
+
 struct array {
 	void **data;
     uint32_t current;
 	uint32_t length;
+	uint32_t capacity;  // slots allocated from data on
+	uint32_t front;     // free slots allocated before data
+	void *small[ARRAY_SMALL]; // used instead of the heap while it fits
 };
 
 struct array *array_new();
@@ -39,23 +44,40 @@ struct array *array_copy(const struct array* original);
 
 // byte_array ///////////////////////////////////////////////////////////////
 
+struct byte_share { // data used by several byte_arrays
+    uint8_t *base;  // the allocation, which slices point into
+    uint32_t refs;  // how many
+    uint32_t size;  // bytes allocated
+    uint32_t used;  // bytes written, as far as the longest of them
+};
+
 struct byte_array {
 	uint8_t *data, *current;
 	uint32_t length;
+	uint32_t capacity; // bytes allocated, unless borrowed or shared
+	bool view; // data is borrowed, e.g. from mapped byte code, and is copied before any change
+	struct byte_share *shared; // data is shared, and is copied before any change
+	bool interned; // the one copy in an intern table, never changed or freed
+	int32_t hash; // map hash, kept once interned, or by a view of interned bytes
 };
 
 struct byte_array *byte_array_new();
 struct byte_array *byte_array_new_size(uint32_t size);
+struct byte_array *byte_array_view(uint8_t *data, uint32_t length);
 void byte_array_append(struct byte_array *a, const struct byte_array* b);
 struct byte_array *byte_array_from_string(const char* str);
 char* byte_array_to_string(const struct byte_array* ba);
 void byte_array_del(struct byte_array* ba);
 struct byte_array *byte_array_copy(const struct byte_array* original);
+struct byte_array *byte_array_share(struct byte_array* original);
+struct byte_array *byte_array_slice(struct byte_array *within, uint32_t start, uint32_t length);
+void byte_array_own(struct byte_array *ba);
 struct byte_array *byte_array_add_byte(struct byte_array *a, uint8_t b);
 void byte_array_reset(struct byte_array* ba);
 void byte_array_resize(struct byte_array* ba, uint32_t size);
 bool byte_array_equals(const struct byte_array *a, const struct byte_array* b);
 struct byte_array *byte_array_concatenate(int n, const struct byte_array* ba, ...);
+struct byte_array *byte_array_join(struct byte_array *a, const struct byte_array *b);
 void byte_array_print(char* into, size_t size, const struct byte_array* ba);
 int32_t byte_array_find(struct byte_array *within, struct byte_array *sought, uint32_t start);
 struct byte_array *byte_array_part(struct byte_array *within, uint32_t start, uint32_t length);
@@ -63,44 +85,48 @@ void byte_array_remove(struct byte_array *within, uint32_t start, int32_t length
 void byte_array_set(struct byte_array *within, uint32_t index, uint8_t byte);
 uint8_t byte_array_get(const struct byte_array *within, uint32_t index);
 struct byte_array *byte_array_replace(struct byte_array *within, struct byte_array *replacement, uint32_t start, int32_t length);
+struct byte_array *byte_array_replace_all(struct byte_array *within, struct byte_array *sought, struct byte_array *replacement);
 
 // stack ////////////////////////////////////////////////////////////////////
 
-struct stack_node {
-	void* data;
-	struct stack_node* next;
-};
-
 struct stack {
-	struct stack_node* head;
-	struct stack_node* tail;
+	void **data;
+	uint32_t depth;
+	uint32_t size;
 };
 
 struct stack* stack_new();
-struct stack_node* stack_node_new();
-void fifo_push(struct stack* fifo, void* data);
+void stack_del(struct stack *stack);
+void stack_reserve(struct stack *stack, uint32_t size);
 void stack_push(struct stack* stack, void* data);
+void stack_push_reserved(struct stack* stack, void* data);
 void* stack_pop(struct stack* stack);
 void* stack_peek(const struct stack* stack, uint8_t index);
 bool stack_empty(const struct stack* stack);
+uint32_t stack_depth(const struct stack *stack);
 
 // map /////////////////////////////////////////////////////////////////////
 
-struct hash_node {
-	void *key;
-	void *data;
-	struct hash_node *next;
-};
-
 typedef bool (map_compare)(const void *a, const void *b);
 typedef int32_t (map_hash)(const void *x);
 typedef void *(map_copyor)(const void *x);
 typedef void (map_rm)(const void *x);
 
+struct map_entry {
+	void *key;
+	void *data;
+	uint32_t hash;
+	bool removed;
+};
+
 struct map {
     map_compare *comparator;
-	size_t size;
-	struct hash_node **nodes;
+	size_t size;            // slots, a power of two
+	uint32_t length;        // keys
+	uint32_t used;          // entries, including removed ones
+	uint8_t *ctrl;          // per slot: empty, deleted or 7 bits of the hash
+	uint32_t *slots;        // per slot: its entry
+	struct map_entry *entries; // in insertion order
     map_hash *hash_func;
     map_rm *deletor;
     map_copyor *copyor;
@@ -114,9 +140,11 @@ int map_remove(struct map* map, const void *key);
 void *map_get(const struct map* map, const void *key);
 bool map_has(const struct map* map, const void *key);
 int map_resize(struct map* map, size_t size);
+bool map_iter(const struct map *m, uint32_t *cursor, const void **key, void **data);
 struct array* map_keys(const struct map* m);
 struct array* map_values(const struct map* m);
 void map_update(struct map *a, const struct map *b);
+struct byte_array *byte_array_intern(struct map *table, const struct byte_array *ba);
 struct map *map_copy(struct map *map);
 
 #endif // STRUCT_H
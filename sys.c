@@ -2,6 +2,9 @@
 #include <string.h>
 #include <ctype.h>
 #include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #include "hal.h"
 #include "interpret.h"
@@ -14,6 +17,10 @@
 #include "node.h"
 
 #define RESERVED_SYS  "sys"
+#define IMAGE_GLOBALS "globals"
+#define ERROR_IMAGE   "bad image"
+#define SAVE_INDEXED  "indexed"
+#define SAVE_COMPRESS "compress"
 
 struct string_func
 {
@@ -38,25 +45,460 @@ struct variable *sys_print(struct context *context)
     return NULL;
 }
 
+static bool save_known(const struct byte_array *name)
+{
+    char *str = byte_array_to_string(name);
+    bool known = !strcmp(str, SAVE_INDEXED) || !strcmp(str, SAVE_COMPRESS);
+    free(str);
+    return known;
+}
+
+// whether options, a name or a list like ['compress':true], turns on name
+static bool save_option(const struct variable *options, const char *name)
+{
+    if (!options)
+        return false;
+    struct byte_array *key = byte_array_from_string(name);
+    const struct variable *on = NULL;
+    if (options->type == VAR_STR)
+        on = byte_array_equals(options->str, key) ? options : NULL;
+    else if (options->map)
+        on = (const struct variable*)map_get(options->map, key);
+    byte_array_del(key);
+    return on && !(on->type == VAR_NIL ||
+                   (on->type == VAR_BOOL && !on->boolean) ||
+                   (on->type == VAR_INT && !on->integer));
+}
+
+// sys.save(value, path, 'indexed') writes an index, so sys.load can decode lazily;
+// ['compress':true] compresses the file
 struct variable *sys_save(struct context *context)
 {
     struct variable *value = (struct variable*)stack_pop(context->operand_stack);
     struct variable *v = (struct variable*)array_get(value->list, 1);
     struct variable *path = (struct variable*)array_get(value->list, 2);
-    struct byte_array *bytes = byte_array_new();
-    variable_serialize(context, bytes, v, true);
+    struct variable *options = value->list->length > 3 ? (struct variable*)array_get(value->list, 3) : NULL;
+    const void *key;
+    if (options && options->type == VAR_STR)
+        vm_assert(context, save_known(options->str), "unknown save option");
+    else for (uint32_t i=0; options && options->map && map_iter(options->map, &i, &key, NULL);)
+        vm_assert(context, save_known((const struct byte_array*)key), "unknown save option");
+    struct byte_array *bytes = variable_save(context, context_buffer(context), v,
+                                             save_option(options, SAVE_INDEXED),
+                                             save_option(options, SAVE_COMPRESS));
     int w = write_file(path->str, bytes);
     return variable_new_int(context, w);
 }
 
+// maps a file for sys.load or an image, failing in the vm rather than
+// exiting if it can't be read or doesn't fit a byte array's 32-bit length
+static struct byte_array *sys_mmap(struct context *context, const struct byte_array *path)
+{
+    char *path_str = byte_array_to_string(path);
+    struct stat st;
+    vm_assert(context, !stat(path_str, &st), "can't open %s", path_str);
+    vm_assert(context, st.st_size <= UINT32_MAX, "%s is over 4 GB, too big to load", path_str);
+    free(path_str);
+    return mmap_file(path);
+}
+
 struct variable *sys_load(struct context *context)
 {
     struct variable *value = (struct variable*)stack_pop(context->operand_stack);
     struct variable *path = (struct variable*)array_get(value->list, 1);
-    struct byte_array *file_bytes = read_file(path->str);
-    if (!file_bytes)
+    struct byte_array *mapped = sys_mmap(context, path->str);
+    struct byte_array *unpacked = variable_unpack(context, mapped);
+    if (unpacked) {
+        unmap_file(mapped);
+        mapped = unpacked;
+    }
+    struct variable *v = variable_deserialize_lazy(context, mapped);
+    if (v) // keeps the mapping
+        return v;
+
+    struct byte_array *file_bytes = mapped;
+    if (!unpacked) {
+        file_bytes = byte_array_new_size(mapped->length);
+        memcpy(file_bytes->data, mapped->data, mapped->length);
+        unmap_file(mapped);
+    }
+    v = variable_deserialize_view(context, file_bytes);
+    byte_array_del(file_bytes);
+    return v;
+}
+
+// streams /////////////////////////////////////////////////////////////////
+
+// streams and files are found by a handle that is never reused, rather than
+// by their fd, which the next open gets once they are closed
+#define HANDLE "handle"
+
+static int32_t handles = 0;
+static struct map *streams = NULL; // handle -> variable_stream
+
+static bool handle_compare(const void *a, const void *b) { return a == b; }
+static int32_t handle_hash(const void *x) { return (int32_t)(VOID_INT)x; }
+static void *handle_copy(const void *x) { return (void*)x; }
+static void handle_del(const void *x) {}
+
+static int32_t handle_new(struct context *context)
+{
+    vm_assert(context, handles < INT32_MAX, "too many handles");
+    return ++handles;
+}
+
+// the handle of the stream or file a method is called on; its other arguments stay in args
+static int32_t handle_of(struct context *context, struct variable **args, const char *what)
+{
+    *args = (struct variable*)stack_pop(context->operand_stack);
+    struct variable *self = (struct variable*)array_get((*args)->list, 0);
+    struct byte_array *key = byte_array_from_string(HANDLE);
+    struct variable *handle = variable_map_get(context, self, key);
+    byte_array_del(key);
+    vm_assert(context, handle && handle->type == VAR_INT, "not a %s", what);
+    return handle->integer;
+}
+
+static void stream_end(int32_t handle)
+{
+    struct variable_stream *stream = (struct variable_stream*)map_get(streams, (void*)(VOID_INT)handle);
+    if (!stream)
+        return;
+    variable_stream_del(stream); // closes fd
+    map_remove(streams, (void*)(VOID_INT)handle);
+}
+
+// the next element, or no value at the end, which closes the stream
+static struct variable *stream_next(struct context *context)
+{
+    struct variable *args;
+    int32_t handle = handle_of(context, &args, "stream");
+    struct variable_stream *stream = (struct variable_stream*)map_get(streams, (void*)(VOID_INT)handle);
+    if (!stream)
         return NULL;
-    return variable_deserialize(context, file_bytes);
+    struct variable *item = variable_stream_next(stream);
+    if (!item)
+        stream_end(handle);
+    return item;
+}
+
+static struct variable *stream_close(struct context *context)
+{
+    struct variable *args;
+    stream_end(handle_of(context, &args, "stream"));
+    return NULL;
+}
+
+// iterates over the elements of a list saved by sys.save, without loading the whole file
+struct variable *sys_stream(struct context *context)
+{
+    struct variable *value = (struct variable*)stack_pop(context->operand_stack);
+    struct variable *path = (struct variable*)array_get(value->list, 1);
+    int32_t handle = handle_new(context);
+    char *path_str = byte_array_to_string(path->str);
+    int fd = open(path_str, O_RDONLY);
+    vm_assert(context, fd >= 0, "can't open %s", path_str);
+    free(path_str);
+
+    if (!streams)
+        streams = map_new_ex(&handle_compare, &handle_hash, &handle_copy, &handle_del);
+    map_insert(streams, (void*)(VOID_INT)handle, variable_stream_new(context, fd));
+
+    struct variable *v = variable_new_list(context, NULL);
+    variable_map_insert(v, byte_array_from_string(HANDLE), variable_new_int(context, handle));
+    variable_map_insert(v, byte_array_from_string(RESERVED_ITERATOR), variable_new_bool(context, true));
+    variable_map_insert(v, byte_array_from_string("next"), variable_new_c(context, &stream_next));
+    variable_map_insert(v, byte_array_from_string("close"), variable_new_c(context, &stream_close));
+    return v;
+}
+
+// files ///////////////////////////////////////////////////////////////////
+
+#define FILE_BUFFER (1 << 20)
+
+struct file {
+    int32_t handle;
+    int fd;
+    struct byte_array *in;  // what has been read; lines are slices of it
+    uint32_t start, end;    // the unread bytes of in
+    uint8_t *out;           // what is waiting to be written
+    uint32_t pending;
+};
+
+static struct map *files = NULL; // handle -> file
+
+// which file a method is called on, or NULL once it is closed; its other arguments stay in args
+static struct file *file_open_self(struct context *context, struct variable **args)
+{
+    int32_t handle = handle_of(context, args, "file");
+    return files ? (struct file*)map_get(files, (void*)(VOID_INT)handle) : NULL;
+}
+
+static struct file *file_self(struct context *context, struct variable **args)
+{
+    struct file *f = file_open_self(context, args);
+    vm_assert(context, f, "file is closed");
+    return f;
+}
+
+static bool file_put(int fd, const uint8_t *data, uint32_t length)
+{
+    for (uint32_t done = 0; done < length;) {
+        ssize_t w = write(fd, data + done, length - done);
+        if (w <= 0)
+            return false;
+        done += (uint32_t)w;
+    }
+    return true;
+}
+
+// false if what was waiting couldn't be written, and is dropped
+static bool file_flush(struct file *f)
+{
+    bool ok = file_put(f->fd, f->out, f->pending);
+    f->pending = 0;
+    return ok;
+}
+
+// moves the descriptor back to where reading got to, and forgets what is buffered
+static void file_unread(struct file *f)
+{
+    if (f->start < f->end)
+        lseek(f->fd, -(off_t)(f->end - f->start), SEEK_CUR);
+    f->start = f->end;
+}
+
+// reads more after the unread bytes, reusing the buffer unless a line still
+// points into it, and growing it when the unread bytes fill it; 0 at the end
+static ssize_t file_fill(struct context *context, struct file *f)
+{
+    vm_assert(context, file_flush(f), ERROR_FWRITE);
+    uint32_t size = f->in->length;
+    if (f->end == size) {
+        uint32_t unread = f->end - f->start;
+        bool busy = f->in->shared && f->in->shared->refs > 1;
+        if (unread == size) {
+            vm_assert(context, size < UINT32_MAX, "can't read 4 GB at once");
+            size = size > UINT32_MAX / 2 ? UINT32_MAX : size * 2;
+        }
+        if (busy || size != f->in->length) {
+            struct byte_array *in = byte_array_new_size(size);
+            memcpy(in->data, f->in->data + f->start, unread);
+            byte_array_del(f->in);
+            f->in = in;
+        } else {
+            memmove(f->in->data, f->in->data + f->start, unread);
+        }
+        f->start = 0;
+        f->end = unread;
+    }
+    ssize_t r = read(f->fd, f->in->data + f->end, size - f->end);
+    vm_assert(context, r >= 0, ERROR_FREAD);
+    f->end += (uint32_t)r;
+    return r;
+}
+
+static struct variable *file_slice(struct context *context, struct file *f, uint32_t length, uint32_t skip)
+{
+    struct byte_array *bytes = byte_array_slice(f->in, f->start, length);
+    f->start += length + skip;
+    return variable_new_str(context, bytes);
+}
+
+static struct variable *file_line(struct context *context, struct file *f)
+{
+    for (uint32_t scanned = 0;;) {
+        uint8_t *from = f->in->data + f->start;
+        uint8_t *nl = (uint8_t*)memchr(from + scanned, '\n', f->end - f->start - scanned);
+        if (nl) {
+            uint32_t length = (uint32_t)(nl - from);
+            bool cr = length && nl[-1] == '\r';
+            return file_slice(context, f, length - cr, 1 + cr);
+        }
+        scanned = f->end - f->start;
+        if (!file_fill(context, f))
+            return f->start < f->end ? file_slice(context, f, f->end - f->start, 0) : NULL;
+    }
+}
+
+// the next line, without its line break, or no value at the end
+static struct variable *file_readline(struct context *context)
+{
+    struct variable *args;
+    return file_line(context, file_self(context, &args));
+}
+
+// f.read(n) reads up to n bytes, and f.read() the rest; no value at the end
+static struct variable *file_read(struct context *context)
+{
+    struct variable *args;
+    struct file *f = file_self(context, &args);
+    struct variable *n = args->list->length > 1 ? (struct variable*)array_get(args->list, 1) : NULL;
+    vm_assert(context, !n || (n->type == VAR_INT && n->integer >= 0), "bad read length");
+    uint32_t want = n ? (uint32_t)n->integer : UINT32_MAX;
+    while (f->end - f->start < want && file_fill(context, f));
+    uint32_t length = f->end - f->start;
+    if (!length && want)
+        return NULL;
+    return file_slice(context, f, length < want ? length : want, 0);
+}
+
+static struct variable *file_write(struct context *context)
+{
+    struct variable *args;
+    struct file *f = file_self(context, &args);
+    struct variable *data = args->list->length > 1 ? (struct variable*)array_get(args->list, 1) : NULL;
+    vm_assert(context, data && data->type == VAR_STR, "can only write strings");
+    file_unread(f);
+    struct byte_array *bytes = data->str;
+    if (f->pending + bytes->length > FILE_BUFFER)
+        vm_assert(context, file_flush(f), ERROR_FWRITE);
+    if (bytes->length >= FILE_BUFFER) {
+        vm_assert(context, file_put(f->fd, bytes->data, bytes->length), ERROR_FWRITE);
+    } else {
+        memcpy(f->out + f->pending, bytes->data, bytes->length);
+        f->pending += bytes->length;
+    }
+    return variable_new_int(context, bytes->length);
+}
+
+// f.seek(n) moves to byte n, or n bytes before the end if n is negative;
+// either way, or with no argument, it returns where the file is
+static struct variable *file_seek(struct context *context)
+{
+    struct variable *args;
+    struct file *f = file_self(context, &args);
+    struct variable *n = args->list->length > 1 ? (struct variable*)array_get(args->list, 1) : NULL;
+    vm_assert(context, !n || n->type == VAR_INT, "bad seek position");
+    vm_assert(context, file_flush(f), ERROR_FWRITE);
+    file_unread(f);
+    off_t at = n ? lseek(f->fd, n->integer, n->integer < 0 ? SEEK_END : SEEK_SET) :
+                   lseek(f->fd, 0, SEEK_CUR);
+    vm_assert(context, at >= 0 && at <= INT32_MAX, "can't seek");
+    return variable_new_int(context, (int32_t)at);
+}
+
+// closes f, even if what was waiting couldn't be written
+static bool file_end(struct file *f)
+{
+    bool flushed = file_flush(f);
+    bool closed = !close(f->fd);
+    map_remove(files, (void*)(VOID_INT)f->handle);
+    byte_array_del(f->in);
+    free(f->out);
+    free(f);
+    return flushed && closed;
+}
+
+// closing a file again does nothing, as for a stream
+static struct variable *file_close(struct context *context)
+{
+    struct variable *args;
+    struct file *f = file_open_self(context, &args);
+    vm_assert(context, !f || file_end(f), ERROR_FWRITE);
+    return NULL;
+}
+
+// so that what was written reaches the file, even if it was never closed
+static void files_flush(void)
+{
+    void *f;
+    for (uint32_t i=0; map_iter(files, &i, NULL, &f);)
+        file_flush((struct file*)f);
+}
+
+// sys.open(path, mode) returns a file, to read, write and iterate over by line,
+// through buffers; mode is 'r' (the default), 'w' or 'a', and '+' for both
+struct variable *sys_open(struct context *context)
+{
+    struct variable *value = (struct variable*)stack_pop(context->operand_stack);
+    struct variable *path = (struct variable*)array_get(value->list, 1);
+    struct variable *mode = value->list->length > 2 ? (struct variable*)array_get(value->list, 2) : NULL;
+    vm_assert(context, path && path->type == VAR_STR, "bad file path");
+    vm_assert(context, !mode || mode->type == VAR_STR, "bad file mode");
+
+    char *mode_str = mode ? byte_array_to_string(mode->str) : NULL;
+    const char *m = mode_str ? mode_str : "r";
+    bool both = strchr(m, '+');
+    int flags;
+    if (m[0] == 'r')
+        flags = both ? O_RDWR : O_RDONLY;
+    else if (m[0] == 'w')
+        flags = (both ? O_RDWR : O_WRONLY) | O_CREAT | O_TRUNC;
+    else if (m[0] == 'a')
+        flags = (both ? O_RDWR : O_WRONLY) | O_CREAT | O_APPEND;
+    else
+        flags = -1;
+    bool known = flags != -1 && strspn(m + 1, "+b") == strlen(m + 1);
+    free(mode_str);
+    vm_assert(context, known, "unknown file mode");
+
+    int32_t handle = handle_new(context);
+    char *path_str = byte_array_to_string(path->str);
+    int fd = open(path_str, flags, 0644);
+    vm_assert(context, fd >= 0, "can't open %s", path_str);
+    free(path_str);
+
+    struct file *f = (struct file*)malloc(sizeof(struct file));
+    assert_message(f, ERROR_ALLOC);
+    f->handle = handle;
+    f->fd = fd;
+    f->in = byte_array_new_size(FILE_BUFFER);
+    f->start = f->end = 0;
+    f->out = (uint8_t*)malloc(FILE_BUFFER);
+    assert_message(f->out, ERROR_ALLOC);
+    f->pending = 0;
+    if (!files) {
+        files = map_new_ex(&handle_compare, &handle_hash, &handle_copy, &handle_del);
+        atexit(&files_flush);
+    }
+    map_insert(files, (void*)(VOID_INT)handle, f);
+
+    struct variable *v = variable_new_list(context, NULL);
+    variable_map_insert(v, byte_array_from_string(HANDLE), variable_new_int(context, handle));
+    variable_map_insert(v, byte_array_from_string("read"), variable_new_c(context, &file_read));
+    variable_map_insert(v, byte_array_from_string("readline"), variable_new_c(context, &file_readline));
+    variable_map_insert(v, byte_array_from_string(RESERVED_ITERATOR), variable_new_bool(context, true));
+    variable_map_insert(v, byte_array_from_string("next"), variable_new_c(context, &file_readline));
+    variable_map_insert(v, byte_array_from_string("write"), variable_new_c(context, &file_write));
+    variable_map_insert(v, byte_array_from_string("seek"), variable_new_c(context, &file_seek));
+    variable_map_insert(v, byte_array_from_string("close"), variable_new_c(context, &file_close));
+    return v;
+}
+
+// saves the global variables and sys, to be restored by filagree --image
+struct variable *sys_snapshot(struct context *context)
+{
+    struct variable *value = (struct variable*)stack_pop(context->operand_stack);
+    struct variable *path = (struct variable*)array_get(value->list, 1);
+    struct program_state *global = (struct program_state*)context->program_stack->data[0];
+
+    struct variable *image = variable_new_map(context, NULL);
+    struct variable *globals = variable_new_map(context, global->named_variables);
+    struct byte_array *sys_name = byte_array_from_string(RESERVED_SYS);
+    variable_map_insert(image, byte_array_from_string(IMAGE_GLOBALS), globals);
+    variable_map_insert(image, sys_name, sys_find(context, sys_name));
+
+    struct byte_array *bytes = variable_serialize(context, context_buffer(context), image, true);
+    int w = write_file(path->str, bytes);
+    return variable_new_int(context, w);
+}
+
+struct map *sys_image(struct context *context, const struct byte_array *path)
+{
+    struct byte_array *bytes = sys_mmap(context, path);
+    struct variable *image = variable_deserialize_view(context, bytes);
+    struct byte_array *sys_name = byte_array_from_string(RESERVED_SYS);
+    struct variable *globals = image->type == VAR_MAP ?
+        variable_map_get(context, image, byte_array_from_string(IMAGE_GLOBALS)) : NULL;
+    struct variable *saved = image->type == VAR_MAP ? variable_map_get(context, image, sys_name) : NULL;
+    vm_assert(context, globals && globals->type == VAR_MAP && saved && saved->type == VAR_MAP && saved->map,
+              ERROR_IMAGE);
+
+    // keep any built-ins added since the snapshot
+    map_update(saved->map, sys_find(context, sys_name)->map);
+    sys = saved;
+    return globals->map ? globals->map : map_new();
 }
 
 struct variable *sys_write(struct context *context)
@@ -65,8 +507,7 @@ struct variable *sys_write(struct context *context)
     struct variable *v = (struct variable*)array_get(value->list, 1);
     struct variable *path = (struct variable*)array_get(value->list, 2);
 
-    struct byte_array *bytes = byte_array_new();
-    variable_serialize(context, bytes, v, true);
+    struct byte_array *bytes = variable_serialize(context, context_buffer(context), v, true);
     int w = write_file(path->str, bytes);
     return variable_new_int(context, w);
 }
@@ -128,6 +569,22 @@ struct variable *sys_bytes(struct context *context)
     return variable_new_bytes(context, NULL, n);
 }
 
+static struct variable *sys_packed(struct context *context, enum VarType type)
+{
+    struct variable *value = (struct variable*)stack_pop(context->operand_stack);
+    vm_assert(context, value->list->length > 1, "%s needs a length or list", var_type_str(type));
+    struct variable *from = (struct variable*)array_get(value->list, 1);
+    return variable_packed_from(context, type, from);
+}
+
+struct variable *sys_ints(struct context *context) {
+    return sys_packed(context, VAR_INTS);
+}
+
+struct variable *sys_floats(struct context *context) {
+    return sys_packed(context, VAR_FLTS);
+}
+
 struct variable *sys_atoi(struct context *context)
 {
     struct variable *value = (struct variable*)stack_pop(context->operand_stack);
@@ -145,8 +602,8 @@ struct variable *sys_atoi(struct context *context)
         n = n*10 + str[offset + i++] - '0';
     n *= negative ? -1 : 1;
 
-    variable_push(context, variable_new_int(context, n));
-    variable_push(context, variable_new_int(context, i));
+    stack_push(context->operand_stack, variable_new_int(context, n));
+    stack_push(context->operand_stack, variable_new_int(context, i));
     return variable_new_src(context, 2);
 }
 
@@ -175,6 +632,25 @@ int32_t param_int(const struct variable *value, uint32_t index) {
     return ((struct variable*)array_get(value->list, index))->integer;
 }
 
+// sys.kv_put(key, value) keeps value under key, in a log that outlives the run; nil removes it
+struct variable *sys_kv_put(struct context *context)
+{
+    struct variable *value = (struct variable*)stack_pop(context->operand_stack);
+    struct variable *key = (struct variable*)array_get(value->list, 1);
+    vm_assert(context, key->type == VAR_STR && value->list->length > 2, "kv_put takes a key and a value");
+    hal_save(context, key->str, (struct variable*)array_get(value->list, 2));
+    return NULL;
+}
+
+// sys.kv_get(key) is the value last put under key, or nil
+struct variable *sys_kv_get(struct context *context)
+{
+    struct variable *value = (struct variable*)stack_pop(context->operand_stack);
+    struct variable *key = (struct variable*)array_get(value->list, 1);
+    vm_assert(context, key->type == VAR_STR, "kv_get takes a key");
+    return hal_load(context, key->str);
+}
+
 #ifndef NO_UI
 
 static struct variable *param_var(const struct variable *value, uint32_t index) {
@@ -185,8 +661,8 @@ static struct variable *param_var(const struct variable *value, uint32_t index)
 
 struct variable *two_ints(struct context *context, int32_t w, int32_t h)
 {
-    variable_push(context, variable_new_int(context, w));
-    variable_push(context, variable_new_int(context, h));
+    stack_push(context->operand_stack, variable_new_int(context, w));
+    stack_push(context->operand_stack, variable_new_int(context, h));
     return variable_new_src(context, 2);
 }
 
@@ -333,8 +809,15 @@ struct string_func builtin_funcs[] = {
     {"write",       &sys_write},
     {"save",        &sys_save},
     {"load",        &sys_load},
+    {"stream",      &sys_stream},
+    {"open",        &sys_open},
+    {"snapshot",    &sys_snapshot},
+    {"kv_get",      &sys_kv_get},
+    {"kv_put",      &sys_kv_put},
     {"remove",      &sys_rm},
     {"bytes",       &sys_bytes},
+    {"ints",        &sys_ints},
+    {"floats",      &sys_floats},
     {"sin",         &sys_sin},
     {"run",         &sys_run},
     {"interpret",   &sys_interpret},
@@ -385,97 +868,510 @@ struct variable *sys_find(struct context *context, const struct byte_array *name
 #define FNC_SERIALIZE   "serialize"
 #define FNC_DESERIALIZE "deserialize"
 #define FNC_SORT        "sort"
+#define FNC_SORT_BY     "sort_by"
 #define FNC_FIND        "find"
 #define FNC_REPLACE     "replace"
 #define FNC_PART        "part"
 #define FNC_REMOVE      "remove"
 #define FNC_INSERT      "insert"
+#define FNC_SUM         "sum"
+#define FNC_MIN         "min"
+#define FNC_MAX         "max"
+#define FNC_DOT         "dot"
+#define FNC_COMPRESS    "compress"
+#define FNC_DECOMPRESS  "decompress"
+
+
+// sorting /////////////////////////////////////////////////////////////////
+//
+// Lists sort as (key, value) pairs, where the key is the value itself or
+// what sort_by's key function returned for it. Keys that all share a type
+// compare inline; a script comparator is only called when one is given.
+// The unstable sort is pattern-defeating quicksort. The stable one merges,
+// and also serves script comparators: it makes the fewest calls, and stays
+// in bounds even if the comparator is inconsistent. Long lists whose keys
+// compare inline sort on several threads.
+
+#define SORT_INSERTION      24  // below this, insertion sort
+#define SORT_NINTHER        128 // above this, pivot is the median of medians
+#define SORT_PARTIAL_LIMIT  8   // moves before giving up on nearly sorted
+
+enum SortKind { SORT_ANY, SORT_INT, SORT_NUM, SORT_STR, SORT_FNC };
+
+struct sort_item {
+    struct variable *key;
+    struct variable *value;
+};
+
+struct sorter {
+    struct context *context;
+    struct variable *comparator;
+    enum SortKind kind;
+};
+
+static enum SortKind sort_kind(const struct sort_item *items, uint32_t n)
+{
+    uint32_t ints = 0, flts = 0, strs = 0;
+    for (uint32_t i=0; i<n; i++)
+        switch (items[i].key->type) {
+            case VAR_INT:   ints++; break;
+            case VAR_FLT:   flts++; break;
+            case VAR_STR:   strs++; break;
+            default:                break;
+        }
+    if (ints == n)
+        return SORT_INT;
+    if (ints + flts == n)
+        return SORT_NUM;
+    return strs == n ? SORT_STR : SORT_ANY;
+}
+
+// a double holds every int and float exactly, so mixed keys keep their order
+static inline double sort_number(const struct variable *v) {
+    return v->type == VAR_INT ? (double)v->integer : v->floater;
+}
 
+static int sort_strings(const struct byte_array *a, const struct byte_array *b)
+{
+    uint32_t n = a->length < b->length ? a->length : b->length;
+    int c = n ? memcmp(a->data, b->data, n) : 0;
+    return c ? c : (a->length > b->length) - (a->length < b->length);
+}
 
-int compar(struct context *context, const void *a, const void *b, struct variable *comparator)
+static int sort_call(struct sorter *s, struct variable *a, struct variable *b)
 {
-    struct variable *av = *(struct variable**)a;
-    struct variable *bv = *(struct variable**)b;
+    struct context *context = s->context;
+    if (s->comparator->type == VAR_FNC)
+        byte_array_reset(s->comparator->str);
+    vm_call(context, s->comparator, a, b, NULL);
+
+    struct variable *result = (struct variable*)stack_pop(context->operand_stack);
+    if (result->type == VAR_SRC)
+        result = (struct variable*)array_get(result->list, 0);
+    vm_assert(context, result->type == VAR_INT, "non-integer comparison result");
+    return result->integer;
+}
 
-    if (comparator) {
+static int sort_compare(struct sorter *s, struct variable *a, struct variable *b)
+{
+    enum SortKind kind = s->kind;
+    if (kind == SORT_ANY) { // mixed list, so go by this pair
+        if (a->type == VAR_STR && b->type == VAR_STR)
+            kind = SORT_STR;
+        else if ((a->type == VAR_INT || a->type == VAR_FLT) && (b->type == VAR_INT || b->type == VAR_FLT))
+            kind = SORT_NUM;
+    }
 
-        byte_array_reset(comparator->str);
-        vm_call(context, comparator, av, bv, NULL);
+    switch (kind) {
+        case SORT_INT:
+            return (a->integer > b->integer) - (a->integer < b->integer);
+        case SORT_NUM: {
+            double x = sort_number(a), y = sort_number(b);
+            if (isnan(x) || isnan(y)) // keeps the order total, with nan last
+                return isnan(x) - isnan(y);
+            return (x > y) - (x < y);
+        }
+        case SORT_STR:
+            return sort_strings(a->str, b->str);
+        case SORT_FNC:
+            return sort_call(s, a, b);
+        default:
+            DEBUGPRINT("can't compare %s to %s\n", var_type_str(a->type), var_type_str(b->type));
+            vm_exit_message(s->context, "incompatible types for comparison");
+            return 0;
+    }
+}
 
-        struct variable *result = (struct variable*)stack_pop(context->operand_stack);
-        if (result->type == VAR_SRC)
-            result = array_get(result->list, 0);
-        assert_message(result->type == VAR_INT, "non-integer comparison result");
-        return result->integer;
+static inline bool sort_less(struct sorter *s, const struct sort_item *a, const struct sort_item *b) {
+    return sort_compare(s, a->key, b->key) < 0;
+}
 
-    } else {
+static inline void sort_swap(struct sort_item *a, struct sort_item *b) {
+    struct sort_item t = *a;
+    *a = *b;
+    *b = t;
+}
 
-        enum VarType at = av->type;
-        enum VarType bt = bv->type;
+// orders a <= b <= c
+static void sort_three(struct sorter *s, struct sort_item *a, struct sort_item *b, struct sort_item *c)
+{
+    if (sort_less(s, b, a))
+        sort_swap(a, b);
+    if (sort_less(s, c, b))
+        sort_swap(b, c);
+    if (sort_less(s, b, a))
+        sort_swap(a, b);
+}
 
-        if (at == VAR_INT && bt == VAR_INT) {
-            // DEBUGPRINT("compare %p:%d to %p:%d : %d\n", av, av->integer, bv, bv->integer, av->integer - bv->integer);
-            return av->integer - bv->integer;
-        } else
-            DEBUGPRINT("can't compare %s to %s\n", var_type_str(at), var_type_str(bt));
+static void sort_insertion(struct sorter *s, struct sort_item *items, uint32_t n)
+{
+    for (uint32_t i=1; i<n; i++) {
+        struct sort_item t = items[i];
+        uint32_t j = i;
+        for (; j && sort_less(s, &t, &items[j-1]); j--)
+            items[j] = items[j-1];
+        items[j] = t;
+    }
+}
 
-        vm_exit_message(context, "incompatible types for comparison");
-        return 0;
+// insertion sort that gives up if the items are not nearly sorted
+static bool sort_partial_insertion(struct sorter *s, struct sort_item *items, uint32_t n)
+{
+    uint32_t moves = 0;
+    for (uint32_t i=1; i<n; i++) {
+        if (!sort_less(s, &items[i], &items[i-1]))
+            continue;
+        struct sort_item t = items[i];
+        uint32_t j = i;
+        do {
+            items[j] = items[j-1];
+        } while (--j && sort_less(s, &t, &items[j-1]));
+        items[j] = t;
+        if ((moves += i - j) > SORT_PARTIAL_LIMIT)
+            return false;
     }
+    return true;
 }
 
-void heapset(size_t width, void *base0, uint32_t index0, void *base1, uint32_t index1) {
-    uint8_t *p0 = (uint8_t*)base0 + index0 * width;
-    uint8_t *p1 = (uint8_t*)base1 + index1 * width;
-    while (width--)
-        *(p0 + width) = *(p1 + width);
+static void sort_sift(struct sorter *s, struct sort_item *items, uint32_t root, uint32_t n)
+{
+    struct sort_item t = items[root];
+    for (uint32_t child; (child = 2*root + 1) < n; root = child) {
+        if (child + 1 < n && sort_less(s, &items[child], &items[child+1]))
+            child++;
+        if (!sort_less(s, &t, &items[child]))
+            break;
+        items[root] = items[child];
+    }
+    items[root] = t;
 }
 
-int heapcmp(struct context *context,
-            size_t width, void *base0, uint32_t index0, void *base1, uint32_t index1,
-            struct variable *comparator)
+// the fallback when quicksort keeps picking bad pivots
+static void sort_heap(struct sorter *s, struct sort_item *items, uint32_t n)
 {
-    uint8_t *p0 = (uint8_t*)base0 + index0 * width;
-    uint8_t *p1 = (uint8_t*)base1 + index1 * width;
-    return compar(context, p0, p1, comparator);
+    for (uint32_t i = n/2; i--;)
+        sort_sift(s, items, i, n);
+    while (n > 1) {
+        sort_swap(&items[0], &items[--n]);
+        sort_sift(s, items, 0, n);
+    }
 }
 
-int heapsortfg(struct context *context, void *base, size_t nel, size_t width, struct variable *comparator)
+// partitions around items[0], with items equal to it going right;
+// the median selection guarantees an item >= the pivot to stop the scan
+static uint32_t sort_partition_right(struct sorter *s, struct sort_item *items, uint32_t n, bool *partitioned)
 {
-    if (!nel)
-        return 0;
-    void *t = malloc(width); // the temporary value
-    unsigned int n = nel, parent = nel/2, index, child; // heap indexes
-    for (;;) { // loop until array is sorted
-        if (parent > 0) { // first stage - Sorting the heap
-            heapset(width, t, 0, base, --parent);
-        } else { // second stage - Extracting elements in-place
-            if (!--n) { // make the heap smaller
-                free(t);
-                return 0; // When the heap is empty, we are done
-            }
-            heapset(width, t, 0, base, n);
-            heapset(width, base, n, base, 0);
+    struct sort_item pivot = items[0];
+    uint32_t first = 0, last = n;
+    while (sort_less(s, &items[++first], &pivot));
+    if (first == 1)
+        while (first < last && !sort_less(s, &items[--last], &pivot));
+    else
+        while (!sort_less(s, &items[--last], &pivot));
+
+    *partitioned = first >= last;
+    while (first < last) {
+        sort_swap(&items[first], &items[last]);
+        while (sort_less(s, &items[++first], &pivot));
+        while (!sort_less(s, &items[--last], &pivot));
+    }
+
+    uint32_t at = first - 1;
+    items[0] = items[at];
+    items[at] = pivot;
+    return at;
+}
+
+// partitions around items[0], with items equal to it going left
+static uint32_t sort_partition_left(struct sorter *s, struct sort_item *items, uint32_t n)
+{
+    struct sort_item pivot = items[0];
+    uint32_t first = 0, last = n;
+    while (sort_less(s, &pivot, &items[--last]));
+    if (last + 1 == n)
+        while (first < last && !sort_less(s, &pivot, &items[++first]));
+    else
+        while (!sort_less(s, &pivot, &items[++first]));
+
+    while (first < last) {
+        sort_swap(&items[first], &items[last]);
+        while (sort_less(s, &pivot, &items[--last]));
+        while (!sort_less(s, &pivot, &items[++first]));
+    }
+
+    items[0] = items[last];
+    items[last] = pivot;
+    return last;
+}
+
+// breaks up patterns that made a partition lopsided
+static void sort_shuffle(struct sort_item *items, uint32_t n)
+{
+    uint32_t q = n / 4;
+    sort_swap(&items[0], &items[q]);
+    sort_swap(&items[n-1], &items[n-q]);
+    if (n > SORT_NINTHER) {
+        sort_swap(&items[1], &items[q+1]);
+        sort_swap(&items[2], &items[q+2]);
+        sort_swap(&items[n-2], &items[n-q-1]);
+        sort_swap(&items[n-3], &items[n-q-2]);
+    }
+}
+
+// leftmost is false when items[-1] is in place and no greater than any item
+static void sort_quick(struct sorter *s, struct sort_item *items, uint32_t n, int bad_allowed, bool leftmost)
+{
+    while (n >= SORT_INSERTION) {
+
+        uint32_t half = n / 2; // pick a pivot and move it to items[0]
+        if (n > SORT_NINTHER) {
+            sort_three(s, &items[0], &items[half], &items[n-1]);
+            sort_three(s, &items[1], &items[half-1], &items[n-2]);
+            sort_three(s, &items[2], &items[half+1], &items[n-3]);
+            sort_three(s, &items[half-1], &items[half], &items[half+1]);
+            sort_swap(&items[0], &items[half]);
+        } else
+            sort_three(s, &items[half], &items[0], &items[n-1]);
+
+        // many equal items: put those equal to items[-1] left and skip them
+        if (!leftmost && !sort_less(s, &items[-1], &items[0])) {
+            uint32_t at = sort_partition_left(s, items, n) + 1;
+            items += at;
+            n -= at;
+            continue;
         }
-        // insert operation - pushing t down the heap to replace the parent
-        index = parent; // start at the parent index
-        child = index * 2 + 1; // get its left child index
-        while (child < n) {
-            if (child + 1 < n  && // choose the largest child
-                heapcmp(context, width, base, child+1, base, child, comparator) > 0) {
-                child++; // right child exists and is bigger
+
+        bool partitioned;
+        uint32_t at = sort_partition_right(s, items, n, &partitioned);
+        uint32_t left = at, right = n - at - 1;
+
+        if (left < n/8 || right < n/8) { // lopsided
+            if (!--bad_allowed) {
+                sort_heap(s, items, n);
+                return;
             }
-            // is the largest child larger than the entry?
-            if (heapcmp(context, width, base, child, t, 0, comparator) > 0) {
-                heapset(width, base, index, base, child);
-                index = child; // move index to the child
-                child = index * 2 + 1; // get the left child and go around again
-            } else
-                break; // t's place is found
+            if (left >= SORT_INSERTION)
+                sort_shuffle(items, left);
+            if (right >= SORT_INSERTION)
+                sort_shuffle(items + at + 1, right);
+        } else if (partitioned &&
+                   sort_partial_insertion(s, items, left) &&
+                   sort_partial_insertion(s, items + at + 1, right))
+            return;
+
+        sort_quick(s, items, left, bad_allowed, leftmost);
+        items += at + 1;
+        n = right;
+        leftmost = false;
+    }
+    sort_insertion(s, items, n);
+}
+
+// merges the sorted runs [0,half) and [half,n); buffer holds half items
+static void sort_join(struct sorter *s, struct sort_item *items, struct sort_item *buffer,
+                      uint32_t half, uint32_t n)
+{
+    memcpy(buffer, items, half * sizeof(struct sort_item));
+    uint32_t i = 0, j = half, k = 0;
+    while (i < half && j < n)
+        items[k++] = sort_less(s, &items[j], &buffer[i]) ? items[j++] : buffer[i++];
+    memcpy(items + k, buffer + i, (half - i) * sizeof(struct sort_item));
+}
+
+// stable; buffer holds at least n/2 items
+static void sort_merge(struct sorter *s, struct sort_item *items, struct sort_item *buffer, uint32_t n)
+{
+    if (n < SORT_INSERTION) {
+        sort_insertion(s, items, n);
+        return;
+    }
+    uint32_t half = n / 2;
+    sort_merge(s, items, buffer, half);
+    sort_merge(s, items + half, buffer, n - half);
+    if (!sort_less(s, &items[half], &items[half-1]))
+        return; // already in order
+
+    sort_join(s, items, buffer, half, n);
+}
+
+static void sort_items(struct sorter *s, struct sort_item *items, struct sort_item *buffer,
+                       uint32_t n, bool stable)
+{
+    if (stable) {
+        sort_merge(s, items, buffer, n);
+        return;
+    }
+    int bad_allowed = 0; // log2(n)
+    for (uint32_t m = n; m >>= 1;)
+        bad_allowed++;
+    sort_quick(s, items, n, bad_allowed, true);
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+
+#include <pthread.h>
+
+#define SORT_THREADS_MAX 64
+
+// sorts a chunk, or if half is set, merges two sorted neighbouring chunks
+struct sort_task {
+    struct sorter *sorter;
+    struct sort_item *items, *buffer;
+    uint32_t half, n;
+    bool stable;
+};
+
+static void sort_task_run(struct sort_task *t)
+{
+    if (t->half)
+        sort_join(t->sorter, t->items, t->buffer, t->half, t->n);
+    else
+        sort_items(t->sorter, t->items, t->buffer, t->n, t->stable);
+}
+
+// worker threads start on the first parallel sort and then stay, waiting
+// for the next batch of tasks; one sort uses the pool at a time
+static struct sort_pool {
+    pthread_mutex_t batch;          // held for a whole parallel sort
+    pthread_mutex_t lock;           // guards the rest
+    pthread_cond_t work, done;
+    struct sort_task *tasks;
+    uint32_t count, next, finished;
+    uint32_t workers;
+} sort_pool = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER,
+               PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER};
+
+// takes the next task of the batch, with sort_pool.lock held
+static void sort_pool_take(void)
+{
+    struct sort_task *t = &sort_pool.tasks[sort_pool.next++];
+    pthread_mutex_unlock(&sort_pool.lock);
+    sort_task_run(t);
+    pthread_mutex_lock(&sort_pool.lock);
+    if (++sort_pool.finished == sort_pool.count)
+        pthread_cond_signal(&sort_pool.done);
+}
+
+static void *sort_pool_worker(void *arg)
+{
+    pthread_mutex_lock(&sort_pool.lock);
+    for (;;) {
+        while (sort_pool.next >= sort_pool.count)
+            pthread_cond_wait(&sort_pool.work, &sort_pool.lock);
+        sort_pool_take();
+    }
+    return NULL;
+}
+
+// runs the tasks at once; this thread takes tasks too, so the batch
+// finishes even if no worker could be started
+static void sort_tasks(struct sort_task *tasks, uint32_t count)
+{
+    pthread_mutex_lock(&sort_pool.lock);
+    while (sort_pool.workers < count - 1) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, &sort_pool_worker, NULL))
+            break;
+        pthread_detach(thread);
+        sort_pool.workers++;
+    }
+
+    sort_pool.tasks = tasks;
+    sort_pool.count = count;
+    sort_pool.next = sort_pool.finished = 0;
+    pthread_cond_broadcast(&sort_pool.work);
+
+    while (sort_pool.next < sort_pool.count)
+        sort_pool_take();
+    while (sort_pool.finished < sort_pool.count)
+        pthread_cond_wait(&sort_pool.done, &sort_pool.lock);
+    pthread_mutex_unlock(&sort_pool.lock);
+}
+
+// sorts one chunk per thread, then merges neighbouring chunks in rounds;
+// only for keys that compare without calling into the vm
+static void sort_parallel(struct sorter *s, struct sort_item *items, struct sort_item *buffer,
+                          uint32_t n, bool stable, uint32_t threads)
+{
+    if (threads > SORT_THREADS_MAX)
+        threads = SORT_THREADS_MAX;
+    pthread_mutex_lock(&sort_pool.batch);
+    uint32_t bounds[SORT_THREADS_MAX + 1];
+    for (uint32_t i=0; i<=threads; i++)
+        bounds[i] = (uint32_t)((uint64_t)n * i / threads);
+
+    struct sort_task tasks[SORT_THREADS_MAX];
+    for (uint32_t i=0; i<threads; i++)
+        tasks[i] = (struct sort_task){s, items + bounds[i], buffer + bounds[i], 0, bounds[i+1] - bounds[i], stable};
+    sort_tasks(tasks, threads);
+
+    for (uint32_t width = 1; width < threads; width *= 2) {
+        uint32_t count = 0;
+        for (uint32_t i=0; i + width < threads; i += 2*width) {
+            uint32_t end = bounds[i + 2*width < threads ? i + 2*width : threads];
+            uint32_t start = bounds[i];
+            tasks[count++] = (struct sort_task){s, items + start, buffer + start,
+                                                bounds[i + width] - start, end - start, stable};
         }
-        // store the temporary value at its new location
-        heapset(width, base, index, t, 0);
+        sort_tasks(tasks, count);
+    }
+    pthread_mutex_unlock(&sort_pool.batch);
+}
+
+#else // no threads
+
+static void sort_parallel(struct sorter *s, struct sort_item *items, struct sort_item *buffer,
+                          uint32_t n, bool stable, uint32_t threads) {
+    sort_items(s, items, buffer, n, stable);
+}
+
+#endif // threads
+
+static struct variable *sort_key(struct context *context, struct variable *keyfn, struct variable *value)
+{
+    if (keyfn->type == VAR_FNC)
+        byte_array_reset(keyfn->str);
+    vm_call(context, keyfn, value, NULL);
+
+    struct variable *result = (struct variable*)stack_pop(context->operand_stack);
+    if (result->type == VAR_SRC)
+        result = result->list->length ? (struct variable*)array_get(result->list, 0) : variable_new_nil(context);
+    return result;
+}
+
+// sorts by key function if given, else by comparator if given, else by value
+static void sort_list(struct context *context, struct array *list,
+                      struct variable *keyfn, struct variable *comparator, bool stable)
+{
+    uint32_t n = list->length;
+    if (n < 2)
+        return;
+
+    struct sort_item *items = (struct sort_item*)malloc(n * sizeof(struct sort_item));
+    assert_message(items, ERROR_ALLOC);
+    for (uint32_t i=0; i<n; i++) {
+        items[i].value = (struct variable*)list->data[i];
+        items[i].key = keyfn ? sort_key(context, keyfn, items[i].value) : items[i].value;
     }
+
+    struct sorter s = {context, comparator, comparator ? SORT_FNC : sort_kind(items, n)};
+    bool parallel = n > context->sort_parallel && context->sort_threads > 1 &&
+                    s.kind != SORT_FNC && s.kind != SORT_ANY; // neither may enter the vm
+    struct sort_item *buffer = NULL;
+    if (parallel || stable || comparator) {
+        buffer = (struct sort_item*)malloc((parallel ? n : n/2) * sizeof(struct sort_item));
+        assert_message(buffer, ERROR_ALLOC);
+    }
+
+    if (parallel)
+        sort_parallel(&s, items, buffer, n, stable, context->sort_threads);
+    else
+        sort_items(&s, items, buffer, n, stable || comparator);
+    free(buffer);
+
+    for (uint32_t i=0; i<n; i++)
+        list->data[i] = items[i].value;
+    free(items);
 }
 
 struct variable *cfnc_char(struct context *context)
@@ -490,23 +1386,147 @@ struct variable *cfnc_char(struct context *context)
     return variable_new_int(context, n);
 }
 
+// list.sort([comparator], [stable])
 struct variable *cfnc_sort(struct context *context)
 {
     struct variable *args = (struct variable*)stack_pop(context->operand_stack);
     struct variable *self = (struct variable*)array_get(args->list, 0);
+    vm_assert(context, self->type == VAR_LST, "sorting a non-list");
 
-    assert_message(self->type == VAR_LST, "sorting a non-list");
-    struct variable *comparator = (args->list->length > 1) ?
-        (struct variable*)array_get(args->list, 1) :
-        NULL;
+    struct variable *comparator = NULL;
+    bool stable = false;
+    for (uint32_t i=1; i<args->list->length; i++) {
+        struct variable *arg = (struct variable*)array_get(args->list, i);
+        if (arg->type == VAR_BOOL)
+            stable = arg->boolean;
+        else
+            comparator = arg;
+    }
 
-    int num_items = self->list->length;
+    sort_list(context, self->list, NULL, comparator, stable);
+    return NULL;
+}
 
-    int success = heapsortfg(context, self->list->data, num_items, sizeof(struct variable*), comparator);
-    assert_message(!success, "error sorting");
+// list.sort_by(key function), calling it once per item; stable
+struct variable *cfnc_sort_by(struct context *context)
+{
+    struct variable *args = (struct variable*)stack_pop(context->operand_stack);
+    struct variable *self = (struct variable*)array_get(args->list, 0);
+    vm_assert(context, self->type == VAR_LST, "sorting a non-list");
+    vm_assert(context, args->list->length > 1, "sort_by needs a key function");
+
+    struct variable *keyfn = (struct variable*)array_get(args->list, 1);
+    sort_list(context, self->list, keyfn, NULL, true);
     return NULL;
 }
 
+// reductions over packed numbers ///////////////////////////////////////////
+//
+// sum and dot keep two vectors of partial sums, to keep up with memory
+
+#ifdef __GNUC__
+#define PACKED_SUM_VECTORS(V)                                                   \
+    V s0 = {0}, s1 = {0}, x0, x1, y0, y1;                                       \
+    for (; i + 2*PACKED_LANES <= n; i += 2*PACKED_LANES) {                      \
+        memcpy(&x0, a + i, sizeof(x0));                                         \
+        memcpy(&x1, a + i + PACKED_LANES, sizeof(x1));                          \
+        if (b) {                                                                \
+            memcpy(&y0, b + i, sizeof(y0));                                     \
+            memcpy(&y1, b + i + PACKED_LANES, sizeof(y1));                      \
+            x0 *= y0;                                                           \
+            x1 *= y1;                                                           \
+        }                                                                       \
+        s0 += x0;                                                               \
+        s1 += x1;                                                               \
+    }                                                                           \
+    s0 += s1;                                                                   \
+    for (int j=0; j<PACKED_LANES; j++)                                          \
+        sum += s0[j];
+#else
+#define PACKED_SUM_VECTORS(V)
+#endif
+
+// the sum of a, or if b is given, of a times b
+#define PACKED_SUM(name, T, V)                                                  \
+static T name(const T *a, const T *b, uint32_t n)                               \
+{                                                                               \
+    T sum = 0;                                                                  \
+    uint32_t i = 0;                                                             \
+    PACKED_SUM_VECTORS(V)                                                       \
+    for (; i<n; i++)                                                            \
+        sum += b ? a[i] * b[i] : a[i];                                          \
+    return sum;                                                                 \
+}
+
+PACKED_SUM(packed_ints_sum, int32_t, packed_ints)
+PACKED_SUM(packed_floats_sum, float, packed_floats)
+
+static struct variable *packed_self(struct context *context, struct variable *args)
+{
+    struct variable *self = (struct variable*)array_get(args->list, 0);
+    vm_assert(context, self->type == VAR_INTS || self->type == VAR_FLTS, "not packed numbers");
+    return self;
+}
+
+static struct variable *packed_sum(struct context *context, struct variable *a, struct variable *b)
+{
+    uint32_t n = PACKED_LENGTH(a);
+    if (a->type == VAR_INTS)
+        return variable_new_int(context, packed_ints_sum((int32_t*)a->str->data,
+                                                         b ? (int32_t*)b->str->data : NULL, n));
+    return variable_new_float(context, packed_floats_sum((float*)a->str->data,
+                                                         b ? (float*)b->str->data : NULL, n));
+}
+
+struct variable *cfnc_sum(struct context *context)
+{
+    struct variable *args = (struct variable*)stack_pop(context->operand_stack);
+    return packed_sum(context, packed_self(context, args), NULL);
+}
+
+struct variable *cfnc_dot(struct context *context)
+{
+    struct variable *args = (struct variable*)stack_pop(context->operand_stack);
+    struct variable *self = packed_self(context, args);
+    vm_assert(context, args->list->length > 1, "dot needs another");
+    struct variable *other = (struct variable*)array_get(args->list, 1);
+    vm_assert(context, other->type == self->type, "dot needs the same packed type");
+    vm_assert(context, PACKED_LENGTH(other) == PACKED_LENGTH(self), "packed lengths differ");
+    return packed_sum(context, self, other);
+}
+
+static struct variable *packed_extreme(struct context *context, bool max)
+{
+    struct variable *args = (struct variable*)stack_pop(context->operand_stack);
+    struct variable *self = packed_self(context, args);
+    uint32_t n = PACKED_LENGTH(self);
+    if (!n)
+        return variable_new_nil(context);
+
+    if (self->type == VAR_INTS) {
+        const int32_t *a = (int32_t*)self->str->data;
+        int32_t m = a[0];
+        for (uint32_t i=1; i<n; i++)
+            if (max ? a[i] > m : a[i] < m)
+                m = a[i];
+        return variable_new_int(context, m);
+    }
+    const float *a = (float*)self->str->data;
+    float m = a[0];
+    for (uint32_t i=1; i<n; i++)
+        if (max ? a[i] > m : a[i] < m)
+            m = a[i];
+    return variable_new_float(context, m);
+}
+
+struct variable *cfnc_min(struct context *context) {
+    return packed_extreme(context, false);
+}
+
+struct variable *cfnc_max(struct context *context) {
+    return packed_extreme(context, true);
+}
+
 struct variable *cfnc_chop(struct context *context, bool part)
 {
     struct variable *args = (struct variable*)stack_pop(context->operand_stack);
@@ -637,7 +1657,27 @@ struct variable *cfnc_deserialize(struct context *context)
     struct variable *indexable = (struct variable*)array_get(args->list, 0);
     struct byte_array *bits = indexable->str;
     byte_array_reset(bits);
-    return variable_deserialize(context, bits);
+    return variable_deserialize_view(context, bits);
+}
+
+struct variable *cfnc_compress(struct context *context)
+{
+    struct variable *args = (struct variable*)stack_pop(context->operand_stack);
+    struct variable *indexable = (struct variable*)array_get(args->list, 0);
+    vm_assert(context, indexable->type == VAR_STR || indexable->type == VAR_BYT, "can only compress bytes");
+    return variable_new_str(context, serial_compress(NULL, indexable->str));
+}
+
+struct variable *cfnc_decompress(struct context *context)
+{
+    struct variable *args = (struct variable*)stack_pop(context->operand_stack);
+    struct variable *indexable = (struct variable*)array_get(args->list, 0);
+    vm_assert(context, indexable->type == VAR_STR || indexable->type == VAR_BYT, "can only decompress bytes");
+    struct byte_array *bits = indexable->str;
+    byte_array_reset(bits);
+    struct byte_array *raw = serial_decompress(bits);
+    vm_assert(context, raw, "bad compressed bytes");
+    return variable_new_str(context, raw);
 }
 
 //    a                b        c
@@ -655,7 +1695,6 @@ struct variable *cfnc_replace(struct context *context)
     null_check(b);
     assert_message(self->type == VAR_STR, "searching in a non-string");
 
-    int32_t where = 0;
     struct byte_array *replaced = self->str;
 
     if (a->type == VAR_STR) { // find a, replace with b
@@ -665,15 +1704,12 @@ struct variable *cfnc_replace(struct context *context)
         if (c) { // replace first match after index b
 
             assert_message(c->type == VAR_INT, "non-integer index");
-            uint32_t found = byte_array_find(self->str, a->str, c->integer);
-            replaced = byte_array_replace(self->str, b->str, found, b->str->length);
-
-        } else for(;;) { // replace all
+            int32_t found = byte_array_find(self->str, a->str, c->integer);
+            replaced = found < 0 ? byte_array_share(self->str) :
+                byte_array_replace(self->str, b->str, found, a->str->length);
 
-            if ((where = byte_array_find(self->str, a->str, where)) < 0)
-                break;
-            replaced = byte_array_replace(replaced, b->str, where++, a->str->length);
-        }
+        } else // replace all
+            replaced = byte_array_replace_all(self->str, a->str, b->str);
 
     } else if (a->type == VAR_INT ) { // replace at index a, length b, insert c
 
@@ -687,6 +1723,37 @@ struct variable *cfnc_replace(struct context *context)
     return variable_new_str(context, replaced);
 }
 
+struct string_func builtin_members[] = {
+    {FNC_SERIALIZE,     &cfnc_serialize},
+    {FNC_DESERIALIZE,   &cfnc_deserialize},
+    {FNC_COMPRESS,      &cfnc_compress},
+    {FNC_DECOMPRESS,    &cfnc_decompress},
+    {FNC_SORT,          &cfnc_sort},
+    {FNC_SORT_BY,       &cfnc_sort_by},
+    {FNC_CHAR,          &cfnc_char},
+    {FNC_HAS,           &cfnc_has},
+    {FNC_FIND,          &cfnc_find},
+    {FNC_PART,          &cfnc_part},
+    {FNC_REMOVE,        &cfnc_remove},
+    {FNC_INSERT,        &cfnc_insert},
+    {FNC_REPLACE,       &cfnc_replace},
+    {FNC_SUM,           &cfnc_sum},
+    {FNC_MIN,           &cfnc_min},
+    {FNC_MAX,           &cfnc_max},
+    {FNC_DOT,           &cfnc_dot},
+};
+
+static bool builtin_named(const char *name)
+{
+    if (!strcmp(name, FNC_STRING) || !strcmp(name, FNC_LIST) ||
+        !strcmp(name, FNC_KEYS) || !strcmp(name, FNC_VALUES))
+        return true;
+    for (int i=0; i<ARRAY_LEN(builtin_members); i++)
+        if (!strcmp(name, builtin_members[i].name))
+            return true;
+    return false;
+}
+
 struct variable *builtin_method(struct context *context,
                                 struct variable *indexable,
                                 const struct variable *index)
@@ -697,8 +1764,11 @@ struct variable *builtin_method(struct context *context,
     if (!strcmp(idxstr, FNC_LENGTH)) {
         int n;
         switch (indexable->type) {
-            case VAR_LST: n = indexable->list->length;  break;
+            case VAR_LAZY:
+            case VAR_LST: n = variable_length(context, indexable); break;
             case VAR_STR: n = indexable->str->length;   break;
+            case VAR_INTS:
+            case VAR_FLTS: n = PACKED_LENGTH(indexable); break;
             default:
                 exit_message("no length for non-indexable");
                 return NULL;
@@ -710,65 +1780,89 @@ struct variable *builtin_method(struct context *context,
         return variable_new_str(context, byte_array_from_string(typestr));
     }
 
+    // a key missing from a loaded list is no reason to decode all of it
+    if (it == VAR_LAZY && !builtin_named(idxstr))
+        return NULL;
+    variable_realize(context, indexable);
+    it = indexable->type;
+
     if (!strcmp(idxstr, FNC_STRING))
         return variable_new_str(context, variable_value(context, indexable));
 
     if (!strcmp(idxstr, FNC_LIST))
-        return variable_new_list(context, indexable->list);
+        return it == VAR_INTS || it == VAR_FLTS ?
+            variable_packed_list(context, indexable) :
+            variable_new_list(context, indexable->list);
 
     if (!strcmp(idxstr, FNC_KEYS)) {
         assert_message(it == VAR_LST, "keys are only for list");
 
         struct variable *v = variable_new_list(context, array_new());
-        if (indexable->map) {
-            const struct array *a = map_keys(indexable->map);
-            for (int i=0; i<a->length; i++) {
-                struct variable *u = variable_new_str(context, (struct byte_array*)array_get(a, i));
-                array_add(v->list, u);
-            }
+        const void *key;
+        for (uint32_t i=0; indexable->map && map_iter(indexable->map, &i, &key, NULL);) {
+            struct variable *u = variable_new_str(context, byte_array_share((struct byte_array*)key));
+            array_add(v->list, u);
         }
         return v;
     }
 
     if (!strcmp(idxstr, FNC_VALUES)) {
         assert_message(it == VAR_LST, "values are only for list");
-        if (!indexable->map)
-            return variable_new_list(context, array_new());
-        else
-            return variable_new_list(context, (struct array*)map_values(indexable->map));
+        struct variable *v = variable_new_list(context, array_new());
+        void *value;
+        for (uint32_t i=0; indexable->map && map_iter(indexable->map, &i, NULL, &value);)
+            array_add(v->list, value);
+        return v;
     }
 
-    if (!strcmp(idxstr, FNC_SERIALIZE))
-        return variable_new_c(context, &cfnc_serialize);
-
-    if (!strcmp(idxstr, FNC_DESERIALIZE))
-        return variable_new_c(context, &cfnc_deserialize);
-
-    if (!strcmp(idxstr, FNC_SORT)) {
+    if (!strcmp(idxstr, FNC_SORT) || !strcmp(idxstr, FNC_SORT_BY))
         assert_message(indexable->type == VAR_LST, "sorting non-list");
-        return variable_new_c(context, &cfnc_sort);
-    }
 
-    if (!strcmp(idxstr, FNC_CHAR))
-        return variable_new_c(context, &cfnc_char);
+    for (int i=0; i<ARRAY_LEN(builtin_members); i++)
+        if (!strcmp(idxstr, builtin_members[i].name))
+            return variable_new_c(context, builtin_members[i].func);
 
-    if (!strcmp(idxstr, FNC_HAS))
-        return variable_new_c(context, &cfnc_has);
-
-    if (!strcmp(idxstr, FNC_FIND))
-        return variable_new_c(context, &cfnc_find);
+    return NULL;
+}
 
-    if (!strcmp(idxstr, FNC_PART))
-        return variable_new_c(context, &cfnc_part);
+// c-functions by name, so that images can refer to them; the name says which
+// table, since one name can be in both, like sys.remove and list.remove
 
-    if (!strcmp(idxstr, FNC_REMOVE))
-        return variable_new_c(context, &cfnc_remove);
+#define C_SYS       "sys."
+#define C_MEMBER    "member."
+#define C_NAME_MAX  32
 
-    if (!strcmp(idxstr, FNC_INSERT))
-        return variable_new_c(context, &cfnc_insert);
+static struct byte_array *c_name(const char *table, const char *name)
+{
+    char full[C_NAME_MAX];
+    snprintf(full, sizeof(full), "%s%s", table, name);
+    return byte_array_from_string(full);
+}
 
-    if (!strcmp(idxstr, FNC_REPLACE))
-        return variable_new_c(context, &cfnc_replace);
+struct byte_array *sys_c_name(callback2func *func)
+{
+    for (int i=0; i<ARRAY_LEN(builtin_funcs); i++)
+        if (builtin_funcs[i].func == func)
+            return c_name(C_SYS, builtin_funcs[i].name);
+    for (int i=0; i<ARRAY_LEN(builtin_members); i++)
+        if (builtin_members[i].func == func)
+            return c_name(C_MEMBER, builtin_members[i].name);
+    return NULL;
+}
 
+// NULL for a name without a table
+callback2func *sys_c_func(const char *name)
+{
+    if (!strncmp(name, C_SYS, strlen(C_SYS))) {
+        name += strlen(C_SYS);
+        for (int i=0; i<ARRAY_LEN(builtin_funcs); i++)
+            if (!strcmp(builtin_funcs[i].name, name))
+                return builtin_funcs[i].func;
+    } else if (!strncmp(name, C_MEMBER, strlen(C_MEMBER))) {
+        name += strlen(C_MEMBER);
+        for (int i=0; i<ARRAY_LEN(builtin_members); i++)
+            if (!strcmp(builtin_members[i].name, name))
+                return builtin_members[i].func;
+    }
     return NULL;
 }
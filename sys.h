@@ -11,6 +11,12 @@ struct variable *builtin_method(struct context *context,
 								struct variable *indexable,
                                 const struct variable *index);
 
+struct byte_array *sys_c_name(callback2func *func);
+
+callback2func *sys_c_func(const char *name);
+
+struct map *sys_image(struct context *context, const struct byte_array *path);
+
 const char *param_str(const struct variable *value, uint32_t index);
 
 int32_t param_int(const struct variable *value, uint32_t index);
@@ -65,23 +65,24 @@ void log_print(const char *format, ...)
     log_len = strnlen(log_message, MESSAGE_MAX);
     if (log_len == MESSAGE_MAX)
         log_message[MESSAGE_MAX-1] = '\n';
-    if (!(newline = strnstr(log_message, "\n", MESSAGE_MAX)))
-        return;
-    size_t line_len = newline - log_message;
-    memcpy(one_line, log_message, line_len);
-    one_line[line_len] = 0;
+    while ((newline = strnstr(log_message, "\n", MESSAGE_MAX))) { // print each complete line
+        size_t line_len = newline - log_message;
+        memcpy(one_line, log_message, line_len);
+        one_line[line_len] = 0;
 
 #ifdef ANDROID
-    __android_log_write(ANDROID_LOG_ERROR, TAG, one_line);
+        __android_log_write(ANDROID_LOG_ERROR, TAG, one_line);
 #elif defined IOS
-    NSLog(@"%s", one_line);
+        NSLog(@"%s", one_line);
 #elifdef MBED
-    usbTxRx.printf("%s\n", one_line);    
+        usbTxRx.printf("%s\n", one_line);
 #else
-    printf("%s\n", one_line);    
+        printf("%s\n", one_line);
 #endif
 
-    memmove(log_message, newline+1, log_len-line_len);
+        memmove(log_message, newline+1, log_len-line_len);
+        log_len -= line_len + 1;
+    }
 }
 
 const char *make_message(const char *format, va_list ap)
@@ -93,7 +94,8 @@ const char *make_message(const char *format, va_list ap)
 
 void exit_message2(const char *format, va_list list)
 {
-    const char *message = make_message(format, list);
+    char message[MESSAGE_MAX];
+    vsnprintf(message, MESSAGE_MAX, format, list); // not make_message, which log_print reuses
     log_print("\n%s\n", message);
     va_end(list);
     exit(1);
@@ -130,6 +132,22 @@ const char* num_to_string(const struct number_string *ns, int num_items, int num
     return NULL;
 }
 
+// hash
+
+#define FNV_OFFSET  0xcbf29ce484222325ULL
+#define FNV_PRIME   0x100000001b3ULL
+
+// 64-bit FNV-1a; pass 0 to start, or a previous hash to continue it
+uint64_t hash_bytes(const uint8_t *data, uint32_t length, uint64_t seed)
+{
+    uint64_t hash = seed ? seed : FNV_OFFSET;
+    for (uint32_t i=0; i<length; i++) {
+        hash ^= data[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
 // file
 
 #define INPUT_MAX_LEN    100000
@@ -149,7 +167,6 @@ struct byte_array *read_file(const struct byte_array *filename_ba)
 {
     FILE * file;
     size_t read;
-    uint8_t *str;
     long size;
     
     const char* filename_str = byte_array_to_string(filename_ba);
@@ -160,41 +177,118 @@ struct byte_array *read_file(const struct byte_array *filename_ba)
         exit_message(ERROR_FSIZE);
     else if (size > INPUT_MAX_LEN)
         exit_message(ERROR_BIG);
-    if (!(str = (uint8_t*)malloc((size_t)size)))// + 1)))
-        exit_message(ERROR_ALLOC);
-    
-    read = fread(str, 1, (size_t)size, file);
+    struct byte_array* ba = byte_array_new_size((uint32_t)size);
+    read = fread(ba->data, 1, (size_t)size, file);
     if (feof(file) || ferror(file))
         exit_message(ERROR_FREAD);
     
     if (fclose(file))
         exit_message(ERROR_FCLOSE);
     
-    struct byte_array* ba = byte_array_new_size(read);
-    ba->data = str;
-    byte_array_reset(ba);
+    ba->length = (uint32_t)read;
     return ba;
 }
 
+#if defined(__unix__) || defined(__APPLE__)
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// maps a file read-only instead of reading it; lengths are 32-bit, so the
+// file must be under 4 GB, which callers with a context check first
+struct byte_array *mmap_file(const struct byte_array *filename_ba)
+{
+    char *filename_str = byte_array_to_string(filename_ba);
+    int fd = open(filename_str, O_RDONLY);
+    free(filename_str);
+    if (fd < 0)
+        exit_message(ERROR_FOPEN);
+
+    struct stat st;
+    if (fstat(fd, &st) || st.st_size < 0)
+        exit_message(ERROR_FSIZE);
+    else if (st.st_size > UINT32_MAX)
+        exit_message(ERROR_BIG);
+    if (!st.st_size) {
+        close(fd);
+        return byte_array_new();
+    }
+
+    void *mapped = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (close(fd))
+        exit_message(ERROR_FCLOSE);
+    if (mapped == MAP_FAILED)
+        exit_message(ERROR_FREAD);
+    return byte_array_view((uint8_t*)mapped, (uint32_t)st.st_size);
+}
+
+// for a mapping known to have no views left
+void unmap_file(struct byte_array *mapped)
+{
+    if (mapped->view && munmap(mapped->data, mapped->length))
+        exit_message(ERROR_FREAD);
+    byte_array_del(mapped);
+}
+
+uint32_t cpu_count() {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (uint32_t)n : 1;
+}
+
+static long process_id() {
+    return (long)getpid();
+}
+
+#else // no mmap
+
+struct byte_array *mmap_file(const struct byte_array *filename) {
+    return read_file(filename);
+}
+
+void unmap_file(struct byte_array *mapped) {
+    byte_array_del(mapped);
+}
+
+uint32_t cpu_count() {
+    return 1;
+}
+
+static long process_id() {
+    return 0;
+}
+
+#endif // mmap
+
 int write_byte_array(struct byte_array* ba, FILE* file) {
     uint16_t len = ba->length;
     int n = fwrite(ba->data, 1, len, file);
     return len - n;
 }
 
+// writes a temporary file and renames it, so that a mapping of the old file,
+// or another process reading it, never sees half of the new one
 int write_file(const struct byte_array* filename, struct byte_array* bytes)
 {
-    const char *fname = byte_array_to_string(filename);
-    FILE* file = fopen(fname, "w");
+    char *fname = byte_array_to_string(filename);
+    char temporary[FILENAME_MAX];
+    snprintf(temporary, sizeof(temporary), "%s.%ld", fname, process_id());
+    FILE* file = fopen(temporary, "wb");
     if (!file) {
-        DEBUGPRINT("could not open file %s\n", fname);
+        DEBUGPRINT("could not open file %s\n", temporary);
+        free(fname);
         return -1;
     }
 
-    int r = fwrite(bytes->data, 1, bytes->length, file);
-    DEBUGPRINT("\twrote %d bytes\n", r);
+    size_t r = fwrite(bytes->data, 1, bytes->length, file);
+    DEBUGPRINT("\twrote %d bytes\n", (int)r);
     int s = fclose(file);
-    return (r<0) || s;
+    int failed = r != bytes->length || s || rename(temporary, fname);
+    if (failed)
+        remove(temporary);
+    free(fname);
+    return failed;
 }
 
 char* build_path(const char* dir, const char* name)
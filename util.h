@@ -42,11 +42,20 @@ void log_print(const char *format, ...);
 #define ERROR_FOPEN     "Could not open file"
 #define ERROR_FREAD     "Could not read file"
 #define ERROR_FCLOSE    "Could not close file"
+#define ERROR_FWRITE    "Could not write file"
 
 struct byte_array *read_file(const struct byte_array *filename);
+struct byte_array *mmap_file(const struct byte_array *filename);
+void unmap_file(struct byte_array *mapped);
 int write_file(const struct byte_array* filename, struct byte_array* bytes);
 long fsize(FILE* file);
 
+uint32_t cpu_count(); // processors online, at least 1
+
+// hash
+
+uint64_t hash_bytes(const uint8_t *data, uint32_t length, uint64_t seed);
+
 struct number_string {
     uint8_t number;
     char* chars;
@@ -1,13 +1,15 @@
 #include <string.h>
+#include <unistd.h>
 #include "vm.h"
 #include "struct.h"
 #include "serial.h"
 #include "variable.h"
 #include "util.h"
+#include "sys.h"
 
 #define ERROR_VAR_TYPE  "type error"
 #define VAR_MAX         1000
-#define VV_SIZE         1000
+#define VV_SIZE         64
 
 const struct number_string var_types[] = {
     {VAR_NIL,   "nil"},
@@ -20,6 +22,9 @@ const struct number_string var_types[] = {
     {VAR_FNC,   "function"},
     {VAR_ERR,   "error"},
     {VAR_C,     "c-function"},
+    {VAR_INTS,  "ints"},
+    {VAR_FLTS,  "floats"},
+    {VAR_LAZY,  "list"},
 };
 
 const char *var_type_str(enum VarType vt)
@@ -69,12 +74,18 @@ void variable_del(struct context *context, struct variable *v)
 {
     context->num_vars--;
     switch (v->type) {
+        case VAR_FNC: // its bytes are freed with the last array that shares them
+            if (!v->str->view && !(v->str->shared && v->str->shared->refs > 1))
+                unverify(context, v->str);
         case VAR_INT:
         case VAR_FLT:
         case VAR_STR:
-        case VAR_FNC:
+        case VAR_INTS:
+        case VAR_FLTS:
             byte_array_del(v->str);
             break;
+        case VAR_LAZY: // shared with its copies
+            break;
         case VAR_LST:
             for (int i=0; i<v->list->length; i++)
                 variable_del(context, (struct variable*)array_get(v->list, i));
@@ -84,14 +95,9 @@ void variable_del(struct context *context, struct variable *v)
             break;
     }
     if (v->map) {
-        struct array *keys = map_keys(v->map);
-        struct array *values = map_values(v->map);
-        for (int i=0; i<keys->length; i++) {
-            byte_array_del((struct byte_array*)array_get(keys, i));
-            variable_del(context, (struct variable*)array_get(values, i));
-        }
-        array_del(keys);
-        array_del(values);
+        void *value;
+        for (uint32_t i=0; map_iter(v->map, &i, NULL, &value);)
+            variable_del(context, (struct variable*)value);
         map_del(v->map);
     }
     free(v);
@@ -122,6 +128,89 @@ struct variable *variable_new_bytes(struct context *context, struct byte_array *
     return v;
 }
 
+// packed numbers //////////////////////////////////////////////////////////
+
+struct variable *variable_new_packed(struct context *context, enum VarType type, uint32_t length)
+{
+    vm_assert(context, length <= UINT32_MAX / PACKED_WIDTH, "too many to pack");
+    struct variable *v = variable_new(context, type);
+    v->str = byte_array_new_size(length * PACKED_WIDTH);
+    if (length)
+        memset(v->str->data, 0, v->str->length);
+    return v;
+}
+
+// from a length, to fill with zeros, or from a list or other packed numbers
+struct variable *variable_packed_from(struct context *context, enum VarType type, const struct variable *from)
+{
+    struct variable *v;
+    switch (from->type) {
+        case VAR_INT:
+            vm_assert(context, from->integer >= 0, "negative length");
+            return variable_new_packed(context, type, from->integer);
+        case VAR_LST:
+            v = variable_new_packed(context, type, from->list->length);
+            for (uint32_t i=0; i<from->list->length; i++)
+                variable_packed_set(context, v, i, (const struct variable*)array_get(from->list, i));
+            return v;
+        case VAR_INTS:
+        case VAR_FLTS: {
+            uint32_t n = PACKED_LENGTH(from);
+            v = variable_new_packed(context, type, n);
+            if (type == from->type) {
+                memcpy(v->str->data, from->str->data, from->str->length);
+                return v;
+            }
+            int32_t *ints = (int32_t*)(type == VAR_INTS ? v->str->data : from->str->data);
+            float *floats = (float*)(type == VAR_FLTS ? v->str->data : from->str->data);
+            for (uint32_t i=0; i<n; i++)
+                if (type == VAR_INTS)
+                    ints[i] = (int32_t)floats[i];
+                else
+                    floats[i] = (float)ints[i];
+            return v;
+        }
+        default:
+            return (struct variable*)vm_exit_message(context, "can't pack %s", var_type_str(from->type));
+    }
+}
+
+struct variable *variable_packed_get(struct context *context, const struct variable *v, uint32_t index)
+{
+    vm_assert(context, index < PACKED_LENGTH(v), ERROR_INDEX);
+    if (v->type == VAR_INTS)
+        return variable_new_int(context, ((int32_t*)v->str->data)[index]);
+    return variable_new_float(context, ((float*)v->str->data)[index]);
+}
+
+void variable_packed_set(struct context *context, struct variable *v, uint32_t index, const struct variable *value)
+{
+    vm_assert(context, index < PACKED_LENGTH(v), ERROR_INDEX);
+    float f;
+    switch (value->type) {
+        case VAR_INT:   f = (float)value->integer;  break;
+        case VAR_FLT:   f = value->floater;         break;
+        case VAR_BOOL:  f = value->boolean;         break;
+        default:
+            vm_exit_message(context, "can't pack %s", var_type_str(value->type));
+            return;
+    }
+    byte_array_own(v->str);
+    if (v->type == VAR_FLTS)
+        ((float*)v->str->data)[index] = f;
+    else
+        ((int32_t*)v->str->data)[index] = value->type == VAR_INT ? value->integer : (int32_t)f;
+}
+
+struct variable *variable_packed_list(struct context *context, const struct variable *v)
+{
+    uint32_t n = PACKED_LENGTH(v);
+    struct array *list = array_new_size(n);
+    for (uint32_t i=0; i<n; i++)
+        array_add(list, variable_packed_get(context, v, i));
+    return variable_new_list(context, list);
+}
+
 struct variable* variable_new_float(struct context *context, float f)
 {
     //DEBUGPRINT("new float %f\n", f);
@@ -159,7 +248,10 @@ struct variable *variable_new_list(struct context *context, struct array *list)
         if (u->type == VAR_MAP) {
             if (v->map == NULL)
                 v->map = map_new(context);
-            map_update(v->map, u->map);
+            const void *key;
+            void *value;
+            for (uint32_t j=0; map_iter(u->map, &j, &key, &value);)
+                map_insert(v->map, key, value);
         } else
             array_set(v->list, v->list->length, u);
     }
@@ -180,49 +272,83 @@ struct variable *variable_new_c(struct context *context, callback2func *cfnc) {
     return v;
 }
 
-const char *variable_value_str2(struct context *context, struct variable* v)
+static void variable_value_str2(struct context *context, struct variable* v, struct byte_array *out, bool realize);
+
+static void append_str(struct byte_array *out, const char *str)
+{
+    size_t n = strlen(str);
+    uint32_t offset = out->length;
+    byte_array_resize(out, out->length + n);
+    memcpy(out->data + offset, str, n);
+}
+
+// realize is false for traces, which must not decode a loaded list
+static void variable_value_str2(struct context *context, struct variable* v, struct byte_array *out, bool realize)
 {
     null_check(v);
+    if (v->type == VAR_LAZY && !realize) {
+        append_str(out, "[...]");
+        return;
+    }
+    variable_realize(context, v);
     enum VarType vt = (enum VarType)v->type;
-    char* str = (char*)malloc(VV_SIZE);
+    char str[VV_SIZE];
+    str[0] = 0;
     struct array* list = v->list;
 
     if (v->visited ==VISITED_MORE) { // first visit of reused variable
         sprintf(str, "&%d", v->mark);
+        append_str(out, str);
         v->visited = VISITED_X;
     }
     else if (v->visited == VISITED_X) { // subsequent visit
         sprintf(str, "*%d", v->mark);
-        return str;
+        append_str(out, str);
+        return;
     }
 
     switch (vt) {
-        case VAR_NIL:    sprintf(str, "%snil", str);                               break;
-        case VAR_INT:    sprintf(str, "%s%d", str, v->integer);                    break;
-        case VAR_BOOL:   sprintf(str, "%s%s", str, v->boolean ? "true" : "false"); break;
-        case VAR_FLT:    sprintf(str, "%s%f", str, v->floater);                    break;
-        case VAR_STR:    sprintf(str, "%s%s", str, byte_array_to_string(v->str));  break;
-        case VAR_FNC:    sprintf(str, "%sf(%dB)", str, v->str->length);            break;
-        case VAR_C:      sprintf(str, "%sc-function", str);                        break;
+        case VAR_NIL:    append_str(out, "nil");                                   break;
+        case VAR_INT:    sprintf(str, "%d", v->integer);    append_str(out, str);  break;
+        case VAR_BOOL:   append_str(out, v->boolean ? "true" : "false");           break;
+        case VAR_FLT:    sprintf(str, "%f", v->floater);    append_str(out, str);  break;
+        case VAR_ERR:
+        case VAR_STR:    byte_array_append(out, v->str);                           break;
+        case VAR_FNC:    sprintf(str, "f(%dB)", v->str->length); append_str(out, str); break;
+        case VAR_C:      append_str(out, "c-function");                            break;
         case VAR_MAP:                                                              break;
         case VAR_SRC:
         case VAR_LST: {
-            strcat(str, "[");
+            append_str(out, "[");
             vm_null_check(context, list);
             for (int i=0; i<list->length; i++) {
                 struct variable* element = (struct variable*)array_get(list, i);
                 vm_null_check(context, element);
                 const char *q = (element->type == VAR_STR || element->type == VAR_FNC) ? "'" : "";
-                const char *c = i ? "," : "";
-                const char *estr = variable_value_str2(context, element);
-                sprintf(str, "%s%s%s%s%s", str, c, q, estr, q);
+                append_str(out, i ? "," : "");
+                append_str(out, q);
+                variable_value_str2(context, element, out, realize);
+                append_str(out, q);
             }
         } break;
-        case VAR_ERR:
-            strcpy(str, byte_array_to_string(v->str));
+        case VAR_INTS:
+        case VAR_FLTS:
+            append_str(out, "[");
+            for (uint32_t i=0; i<PACKED_LENGTH(v); i++) {
+                if (vt == VAR_INTS)
+                    sprintf(str, i ? ",%d" : "%d", ((int32_t*)v->str->data)[i]);
+                else
+                    sprintf(str, i ? ",%f" : "%f", ((float*)v->str->data)[i]);
+                append_str(out, str);
+            }
+            append_str(out, "]");
             break;
         case VAR_BYT:
-            byte_array_print(str, VV_SIZE, v->str);
+            append_str(out, "0x");
+            for (int i=0; i<v->str->length; i++) {
+                sprintf(str, "%02X", v->str->data[i]);
+                append_str(out, str);
+            }
             break;
         default:
             vm_exit_message(context, ERROR_VAR_TYPE);
@@ -230,30 +356,22 @@ const char *variable_value_str2(struct context *context, struct variable* v)
     }
 
     if (v->map) {
-        const struct array *a = map_keys(v->map);
-        const struct array *b = map_values(v->map);
-
         if (vt != VAR_LST)
-            strcat(str, "<");
-        else if (v->list->length && a->length)
-            strcat(str, ",");
-        for (int i=0; i<a->length; i++) {
-            if (i)
-                strcat(str, ",");
-            strcat(str, "'");
-            strcat(str, byte_array_to_string((struct byte_array*)array_get(a,i)));
-            strcat(str, "'");
-            strcat(str, ":");
-            struct variable *biv = (struct variable*)array_get(b,i);
-            const char *bistr = variable_value_str2(context, biv);
-            strcat(str, bistr);
+            append_str(out, "<");
+        const void *key;
+        void *value;
+        for (uint32_t i=0, n=0; map_iter(v->map, &i, &key, &value); n++) {
+            if (n || (vt == VAR_LST && v->list->length))
+                append_str(out, ",");
+            append_str(out, "'");
+            byte_array_append(out, (const struct byte_array*)key);
+            append_str(out, "':");
+            variable_value_str2(context, (struct variable*)value, out, realize);
         }
-        strcat(str, vt==VAR_LST ? "]" : ">");
+        append_str(out, vt==VAR_LST ? "]" : ">");
     }
     else if (vt == VAR_LST || vt == VAR_SRC)
-        strcat(str, "]");
-
-    return str;
+        append_str(out, "]");
 }
 
 static void variable_mark2(struct variable *v, uint32_t *marker)
@@ -270,9 +388,9 @@ static void variable_mark2(struct variable *v, uint32_t *marker)
     v->visited = VISITED_ONCE;
 
     if (v->map) {
-        const struct array *values = map_values(v->map);
-        for (int i=0; values && i<values->length; i++)
-            variable_mark2((struct variable*)array_get(values, i), marker);
+        void *value;
+        for (uint32_t i=0; map_iter(v->map, &i, NULL, &value);)
+            variable_mark2((struct variable*)value, marker);
     }
 
     if (v->type == VAR_LST) {
@@ -300,28 +418,45 @@ void variable_unmark(struct variable *v)
         }
     }
     if (v->map) {
-        const struct array *a = map_keys(v->map);
-        const struct array *b = map_values(v->map);
-        for (int i=0; i<a->length; i++) {
-            struct variable *biv = (struct variable*)array_get(b,i);
-            variable_unmark(biv);
-        }
+        void *value;
+        for (uint32_t i=0; map_iter(v->map, &i, NULL, &value);)
+            variable_unmark((struct variable*)value);
     }
 }
 
 
-const char *variable_value_str(struct context *context, struct variable* v)
+static struct byte_array *variable_value2(struct context *context, struct variable *v, bool realize)
 {
+    struct byte_array *out = byte_array_new();
     variable_unmark(v);
     variable_mark(v);
-    const char *str = variable_value_str2(context, v);
+    variable_value_str2(context, v, out, realize);
     variable_unmark(v);
+    return out;
+}
+
+static const char *variable_str(struct context *context, struct variable* v, bool realize)
+{
+    struct byte_array *value = variable_value2(context, v, realize);
+    char *str = byte_array_to_string(value);
+    byte_array_del(value);
     return str;
 }
 
-struct byte_array *variable_value(struct context *c, struct variable *v) {
-    const char *str = variable_value_str(c, v);
-    return byte_array_from_string(str);
+const char *variable_value_str(struct context *context, struct variable* v)
+{
+    return variable_str(context, v, true);
+}
+
+// for debug traces: a loaded list that is not yet decoded shows as [...]
+const char *variable_trace_str(struct context *context, struct variable* v)
+{
+    return variable_str(context, v, false);
+}
+
+struct byte_array *variable_value(struct context *context, struct variable *v)
+{
+    return variable_value2(context, v, true);
 }
 
 struct variable *variable_pop(struct context *context)
@@ -340,80 +475,1176 @@ struct variable *variable_pop(struct context *context)
     return v;
 }
 
+// for instructions, whose pushes verify counted and run reserved room for
 void variable_push(struct context *context, struct variable *v)
 {
-    stack_push(context->operand_stack, v);
+    stack_push_reserved(context->operand_stack, v);
 }
 
-struct byte_array *variable_serialize(struct context *context,
-									  struct byte_array *bits,
-                                      const struct variable *in,
-                                      bool withType)
+// serialization ////////////////////////////////////////////////////////////
+//
+// A variable is its type followed by its value. Each variable, list and
+// non-empty map is written once, numbered in the order written; a negative
+// type refers back to an earlier variable, a negative list length to an
+// earlier list, and a negative map length to an earlier map, so sharing and
+// cycles survive. Lists and maps always carry their map, other types only
+// when flagged.
+//
+// An indexed list or map is followed by the byte size of its body. The body
+// is the list length, an offset per element, the map length, a key and an
+// offset per entry, and then the elements and values themselves. Offsets
+// are 32 bits in host order, from the start of the body, so any element can
+// be found without decoding the others. Small lists and maps aren't indexed.
+// A hashed body also has, after the map length, a power of two number of
+// slots, each the offset of an entry's key or HASH_EMPTY, so a key is found
+// by probing from its hash_bytes.
+//
+// A list of records, maps that all have the same keys, may instead be its
+// length, the keys, and groups of up to COLUMN_ROWS records stored by key:
+// per key, integers as deltas from the one before, strings as themselves or
+// as indexes into a dictionary, and anything else as variables. Its rows,
+// with their lists and maps, are numbered before any field; integer and
+// string fields are written by value and not numbered.
+//
+// sys.save starts with SERIAL_MARK and a version, and may compress the
+// rest, see serial_compress.
+
+#define SERIAL_MAPPED   0x20    // type flag: a map follows the value
+#define SERIAL_INDEXED  0x40    // type flag: an indexed list or map
+#define SERIAL_COLUMNS  0x80    // type flag: a list of records, by key
+#define SERIAL_HASHED   0x100   // type flag: an indexed map with a hash table
+#define SERIAL_MARK     0x7f    // reads as a negative type, so no older save starts with it
+#define SERIAL_VERSION  3       // 2 shares, 3 hashes
+#define INDEX_WIDTH     sizeof(uint32_t)
+#define INDEX_MIN       8       // smaller lists and maps are cheaper to decode whole
+#define HASH_MIN        16      // fewer keys are quicker to compare in turn
+#define HASH_EMPTY      UINT32_MAX
+#define COLUMN_MIN      4       // fewer records are stored as they are
+#define COLUMN_ROWS     4096
+
+enum Column {
+    COLUMN_ANY,
+    COLUMN_INT,
+    COLUMN_STR,
+    COLUMN_DICT,
+};
+
+enum SerialMode {
+    MODE_SHARED,
+    MODE_INDEXED,               // without sharing, which lazy loading can't follow
+    MODE_COLUMNS,
+};
+
+struct lazy {
+    struct byte_array *bits;    // never freed, usually a mapped file
+    uint32_t body;
+    enum VarType type;
+    bool hashed;
+    struct map *cache;          // body offset -> variable already decoded
+    bool real;                  // list and map hold the decoded contents
+    struct array *list;
+    struct map *map;
+};
+
+struct serializer {
+    struct context *context;
+    struct byte_array *bits;
+    struct map *seen;           // variable, list or map -> id, when sharing
+    struct map *open;           // lists and maps being written, when not
+    uint32_t ids;
+    bool indexed;               // write lists and maps with an index
+    bool columns;               // write lists of records by key
+    const struct array *apart;  // the saved list, whose elements share nothing, for sys.stream
+    struct array *scope;        // what the element being written apart has numbered
+};
+
+struct deserializer {
+    struct context *context;
+    struct byte_array *bits;
+    struct array *seen;         // variables, lists and maps, by id, unless lazy
+    uint32_t base;              // id of seen[0]
+    bool view;                  // strings are slices of bits
+    int fd;                     // refills bits when streaming, else -1
+    bool lazy;                  // indexed lists and maps stay encoded
+    struct map *cache;          // of the lazy list being decoded
+};
+
+static bool ptr_compare(const void *a, const void *b) { return a == b; }
+static int32_t ptr_hash(const void *p) { return (int32_t)((VOID_INT)p >> 4); }
+static void *ptr_copy(const void *p) { return (void*)p; }
+static void ptr_del(const void *p) {}
+
+// numbers p, which hasn't been written
+static void serialize_number(struct serializer *s, const void *p)
 {
-	null_check(context);
-    //DEBUGPRINT("\tserialize:%s\n", variable_value_str(context, (struct variable*)in));
-    if (!bits)
-        bits = byte_array_new();
+    if (!s->seen)
+        return;
+    map_insert(s->seen, p, (void*)(VOID_INT)++s->ids);
+    if (s->scope)
+        array_add(s->scope, (void*)p);
+}
+
+// forgets what the last element written apart numbered, so later ones
+// write it again rather than refer back; ids keep counting
+static void serialize_forget(struct serializer *s)
+{
+    for (uint32_t i=0; i<s->scope->length; i++)
+        map_remove(s->seen, array_get(s->scope, i));
+    s->scope->length = 0;
+}
+
+// whether p hasn't been written, nor added to fresh
+static bool serialize_fresh(const struct serializer *s, struct map *fresh, const void *p)
+{
+    if (map_get(s->seen, p) || map_get(fresh, p))
+        return false;
+    map_insert(fresh, p, (void*)1);
+    return true;
+}
+
+// writes a back reference and returns true if p was already written
+static bool serialize_seen(struct serializer *s, const void *p)
+{
+    if (!s->seen)
+        return false;
+    VOID_INT id = (VOID_INT)map_get(s->seen, p);
+    if (id) {
+        serial_encode_int(s->bits, -(int32_t)id);
+        return true;
+    }
+    serialize_number(s, p);
+    return false;
+}
+
+static void serialize_variable(struct serializer *s, const struct variable *in, bool withType);
+
+// makes room for n offsets, returning where
+static uint32_t index_reserve(struct byte_array *bits, uint32_t n)
+{
+    uint32_t at = bits->length;
+    byte_array_resize(bits, at + n * INDEX_WIDTH);
+    bits->current = bits->data + bits->length;
+    return at;
+}
+
+static void index_put(struct byte_array *bits, uint32_t at, uint32_t offset)
+{
+    memcpy(bits->data + at, &offset, INDEX_WIDTH);
+}
+
+static uint32_t index_get(const struct byte_array *bits, uint32_t at)
+{
+    uint32_t offset;
+    memcpy(&offset, bits->data + at, INDEX_WIDTH);
+    return offset;
+}
+
+// puts at in the first free slot from key's hash
+static void index_hash(struct byte_array *bits, uint32_t table, uint32_t slots,
+                       const struct byte_array *key, uint32_t at)
+{
+    uint32_t slot = (uint32_t)hash_bytes(key->data, key->length, 0) & (slots - 1);
+    while (index_get(bits, table + slot * INDEX_WIDTH) != HASH_EMPTY)
+        slot = (slot + 1) & (slots - 1);
+    index_put(bits, table + slot * INDEX_WIDTH, at);
+}
+
+static bool serialize_indexes(const struct serializer *s, const struct variable *in)
+{
+    if (!s->indexed || (in->type != VAR_LST && in->type != VAR_MAP))
+        return false;
+    uint32_t n = in->type == VAR_LST ? in->list->length : 0;
+    for (uint32_t i=0; n < INDEX_MIN && in->map && map_iter(in->map, &i, NULL, NULL);)
+        n++;
+    return n >= INDEX_MIN;
+}
+
+static void serialize_indexed(struct serializer *s, const struct variable *in)
+{
+    struct byte_array *bits = s->bits;
+    uint32_t m = 0;
+    for (uint32_t i=0; in->map && map_iter(in->map, &i, NULL, NULL);)
+        m++;
+    bool hashed = m >= HASH_MIN;
+    serial_encode_int(bits, in->type | SERIAL_INDEXED | (hashed ? SERIAL_HASHED : 0));
+    uint32_t size = index_reserve(bits, 1);
+    uint32_t body = bits->length;
+
+    const struct array *list = in->type == VAR_LST ? in->list : NULL;
+    uint32_t n = list ? list->length : 0;
+    serial_encode_int(bits, n);
+    uint32_t items = index_reserve(bits, n);
+
+    serial_encode_int(bits, m);
+    uint32_t slots = 0, table = 0;
+    if (hashed) { // at most half full
+        for (slots = 1; slots < 2 * m; slots *= 2);
+        serial_encode_int(bits, slots);
+        table = index_reserve(bits, slots);
+        memset(bits->data + table, 0xff, slots * INDEX_WIDTH);
+    }
+    uint32_t *entries = (uint32_t*)malloc(m * INDEX_WIDTH + 1);
+    const void *key;
+    void *value;
+    uint32_t j = 0;
+    for (uint32_t i=0; in->map && map_iter(in->map, &i, &key, NULL); j++) {
+        const struct byte_array *k = (const struct byte_array*)key;
+        uint32_t at = bits->length - body;
+        serial_encode_string(bits, k);
+        entries[j] = index_reserve(bits, 1);
+        if (hashed)
+            index_hash(bits, table, slots, k, at);
+    }
+
+    for (uint32_t i=0; i<n; i++) {
+        index_put(bits, items + i * INDEX_WIDTH, bits->length - body);
+        serialize_variable(s, (const struct variable*)array_get(list, i), true);
+    }
+    j = 0;
+    for (uint32_t i=0; in->map && map_iter(in->map, &i, NULL, &value); j++) {
+        index_put(bits, entries[j], bits->length - body);
+        serialize_variable(s, (const struct variable*)value, true);
+    }
+    free(entries);
+    index_put(bits, size, bits->length - body);
+}
+
+static void serialize_map(struct serializer *s, const struct map *map)
+{
+    if (!map) {
+        serial_encode_int(s->bits, 0);
+        return;
+    }
+    const void *key;
+    void *value;
+    uint32_t n = 0;
+    for (uint32_t i=0; map_iter(map, &i, NULL, NULL);)
+        n++;
+    if (!n)
+        serial_encode_int(s->bits, 0);
+    else if (!serialize_seen(s, map)) {
+        serial_encode_int(s->bits, n);
+        for (uint32_t i=0; map_iter(map, &i, &key, &value);) {
+            serial_encode_string(s->bits, (const struct byte_array*)key);
+            serialize_variable(s, (const struct variable*)value, true);
+        }
+    }
+}
+
+static void serialize_list(struct serializer *s, const struct array *list)
+{
+    if (serialize_seen(s, list))
+        return;
+    serial_encode_int(s->bits, list->length);
+    if (list == s->apart)
+        s->scope = array_new();
+    for (int i=0; i<list->length; i++) {
+        serialize_variable(s, (const struct variable*)array_get(list, i), true);
+        if (s->scope)
+            serialize_forget(s);
+    }
+    if (list == s->apart) {
+        array_del(s->scope);
+        s->scope = NULL;
+    }
+}
+
+static bool is_record(const struct variable *v)
+{
+    return v->type == VAR_LST && !v->list->length && v->map && v->map->length;
+}
+
+// how many keys every element of a list of records has, else 0;
+// rows referred to elsewhere are written as they are
+static uint32_t record_keys(const struct serializer *s, const struct variable *in)
+{
+    if (!s->columns || in->type != VAR_LST || in->list->length < COLUMN_MIN || map_get(s->seen, in->list))
+        return 0;
+    const struct variable *first = (const struct variable*)array_get(in->list, 0);
+    if (!is_record(first))
+        return 0;
+    struct map *fresh = map_new_ex(&ptr_compare, &ptr_hash, &ptr_copy, &ptr_del);
+    uint32_t k = first->map->length;
+    const void *key;
+    for (uint32_t i=0; k && i<in->list->length; i++) {
+        const struct variable *row = (const struct variable*)array_get(in->list, i);
+        if (!is_record(row) || row->map->length != first->map->length ||
+            !serialize_fresh(s, fresh, row) ||
+            !serialize_fresh(s, fresh, row->list) ||
+            !serialize_fresh(s, fresh, row->map))
+            k = 0;
+        for (uint32_t j=0; k && map_iter(first->map, &j, &key, NULL);)
+            if (!map_get(row->map, key))
+                k = 0;
+    }
+    map_del(fresh);
+    return k;
+}
+
+static const struct variable *record_field(const struct array *rows, uint32_t i, const void *key)
+{
+    return (const struct variable*)map_get(((const struct variable*)array_get(rows, i))->map, key);
+}
+
+static enum Column column_kind(const struct array *rows, uint32_t start, uint32_t end, const void *key)
+{
+    bool ints = true, strs = true;
+    int32_t previous = 0;
+    for (uint32_t i=start; i<end && (ints || strs); i++) {
+        const struct variable *v = record_field(rows, i, key);
+        if (v->map)
+            return COLUMN_ANY;
+        ints = ints && v->type == VAR_INT && (int32_t)((uint32_t)v->integer - (uint32_t)previous) != INT32_MIN;
+        strs = strs && v->type == VAR_STR;
+        previous = v->integer;
+    }
+    return ints ? COLUMN_INT : strs ? COLUMN_STR : COLUMN_ANY;
+}
+
+static void serialize_column(struct serializer *s, const struct array *rows,
+                             uint32_t start, uint32_t end, const void *key)
+{
+    struct byte_array *bits = s->bits;
+    enum Column kind = column_kind(rows, start, end, key);
+
+    struct map *dictionary = NULL;
+    struct array *words = NULL;
+    if (kind == COLUMN_STR) { // worth it if most strings repeat
+        dictionary = map_new();
+        words = array_new();
+        for (uint32_t i=start; i<end; i++) {
+            struct byte_array *str = record_field(rows, i, key)->str;
+            if (!map_get(dictionary, str)) {
+                array_add(words, str);
+                map_insert(dictionary, str, (void*)(VOID_INT)words->length);
+            }
+        }
+        if (words->length * 2 <= end - start)
+            kind = COLUMN_DICT;
+    }
+
+    serial_encode_int(bits, kind);
+    int32_t previous = 0;
+    switch (kind) {
+        case COLUMN_INT:
+            for (uint32_t i=start; i<end; i++) {
+                int32_t n = record_field(rows, i, key)->integer;
+                serial_encode_int(bits, (int32_t)((uint32_t)n - (uint32_t)previous));
+                previous = n;
+            }
+            break;
+        case COLUMN_STR:
+            for (uint32_t i=start; i<end; i++)
+                serial_encode_string(bits, record_field(rows, i, key)->str);
+            break;
+        case COLUMN_DICT:
+            serial_encode_int(bits, words->length);
+            for (uint32_t i=0; i<words->length; i++)
+                serial_encode_string(bits, (const struct byte_array*)array_get(words, i));
+            for (uint32_t i=start; i<end; i++)
+                serial_encode_int(bits, (VOID_INT)map_get(dictionary, record_field(rows, i, key)->str) - 1);
+            break;
+        case COLUMN_ANY:
+            for (uint32_t i=start; i<end; i++)
+                serialize_variable(s, record_field(rows, i, key), true);
+            break;
+    }
+    if (dictionary) {
+        map_del(dictionary);
+        words->length = 0; // keep the contents
+        array_del(words);
+    }
+}
+
+static void serialize_records(struct serializer *s, const struct variable *in, uint32_t k)
+{
+    struct byte_array *bits = s->bits;
+    const struct array *rows = in->list;
+    const struct map *schema = ((const struct variable*)array_get(rows, 0))->map;
+    serial_encode_int(bits, VAR_LST | SERIAL_COLUMNS);
+    serial_encode_int(bits, rows->length);
+    serial_encode_int(bits, k);
+    const void *key;
+    for (uint32_t j=0; map_iter(schema, &j, &key, NULL);)
+        serial_encode_string(bits, (const struct byte_array*)key);
+    serialize_number(s, rows);
+    for (uint32_t i=0; i<rows->length; i++) {
+        const struct variable *row = (const struct variable*)array_get(rows, i);
+        serialize_number(s, row);
+        serialize_number(s, row->list);
+        serialize_number(s, row->map);
+    }
+    if (rows == s->apart) // sys.stream reads a group of rows at a time
+        s->scope = array_new();
+    for (uint32_t start=0; start<rows->length; start += COLUMN_ROWS) {
+        uint32_t end = rows->length - start > COLUMN_ROWS ? start + COLUMN_ROWS : rows->length;
+        for (uint32_t j=0; map_iter(schema, &j, &key, NULL);)
+            serialize_column(s, rows, start, end, key);
+        if (s->scope)
+            serialize_forget(s);
+    }
+    if (rows == s->apart) {
+        array_del(s->scope);
+        s->scope = NULL;
+    }
+    serialize_map(s, in->map);
+}
+
+static void serialize_value(struct serializer *s, const struct variable *in, bool withType)
+{
+    if (withType && serialize_seen(s, in))
+        return;
+    if (withType && serialize_indexes(s, in)) {
+        serialize_indexed(s, in);
+        return;
+    }
+    uint32_t k = withType ? record_keys(s, in) : 0;
+    if (k) {
+        serialize_records(s, in, k);
+        return;
+    }
+    struct byte_array *bits = s->bits;
+    bool mapped = in->map && in->type != VAR_LST && in->type != VAR_MAP;
     if (withType)
-        serial_encode_int(bits, in->type);
+        serial_encode_int(bits, in->type | (mapped ? SERIAL_MAPPED : 0));
     switch (in->type) {
-        case VAR_INT:    serial_encode_int(bits, in->integer);    break;
-        case VAR_FLT:    serial_encode_float(bits, in->floater);    break;
+        case VAR_NIL:                                                   break;
+        case VAR_INT:   serial_encode_int(bits, in->integer);           break;
+        case VAR_BOOL:  serial_encode_int(bits, in->boolean);           break;
+        case VAR_FLT:   serial_encode_float(bits, in->floater);         break;
         case VAR_STR:
-        case VAR_FNC:    serial_encode_string(bits, in->str);        break;
-        case VAR_LST: {
-            serial_encode_int(bits, in->list->length);
-            for (int i=0; i<in->list->length; i++)
-                variable_serialize(context, bits, (const struct variable*)array_get(in->list, i), true);
-            if (in->map) {
-                const struct array *keys = map_keys(in->map);
-                const struct array *values = map_values(in->map);
-                serial_encode_int(bits, keys->length);
-                for (int i=0; i<keys->length; i++) {
-                    serial_encode_string(bits, (const struct byte_array*)array_get(keys, i));
-                    variable_serialize(context, bits, (const struct variable*)array_get(values, i), true);
-                }
-            } else
-                serial_encode_int(bits, 0);
+        case VAR_FNC:
+        case VAR_ERR:
+        case VAR_BYT:
+        case VAR_INTS:
+        case VAR_FLTS:  serial_encode_string(bits, in->str);            break;
+        case VAR_LST:   serialize_list(s, in->list);                    break;
+        case VAR_MAP:                                                   break;
+        case VAR_C: {
+            struct byte_array *name = sys_c_name(in->cfnc);
+            vm_assert(s->context, name, "unnamed c-function");
+            serial_encode_string(bits, name);
+            byte_array_del(name);
         } break;
-        default:        vm_exit_message(context, "bad var type");                break;
+        default:        vm_exit_message(s->context, "bad var type");    break;
     }
+    if (mapped || in->type == VAR_LST || in->type == VAR_MAP)
+        serialize_map(s, in->map);
+}
 
-    return bits;
+// without sharing, a cycle would never end
+static void serialize_open(struct serializer *s, const void *p, bool open)
+{
+    if (!p || !s->open)
+        return;
+    if (!open)
+        map_remove(s->open, p);
+    else {
+        vm_assert(s->context, !map_get(s->open, p), "can't save a cycle indexed");
+        map_insert(s->open, p, (void*)1);
+    }
 }
 
-struct variable *variable_deserialize(struct context *context, struct byte_array *bits)
+static void serialize_variable(struct serializer *s, const struct variable *in, bool withType)
+{
+    variable_realize(s->context, (struct variable*)in);
+    const void *list = in->type == VAR_LST ? in->list : NULL;
+    serialize_open(s, list, true);
+    serialize_open(s, in->map, true);
+    serialize_value(s, in, withType);
+    serialize_open(s, in->map, false);
+    serialize_open(s, list, false);
+}
+
+static struct byte_array *variable_serialize2(struct context *context,
+                                              struct byte_array *bits,
+                                              const struct variable *in,
+                                              bool withType,
+                                              enum SerialMode mode)
 {
 	null_check(context);
-    enum VarType vt = (enum VarType)serial_decode_int(bits);
-    switch (vt) {
-        case VAR_NIL:    return variable_new_nil(context);
-        case VAR_INT:    return variable_new_int(context, serial_decode_int(bits));
-        case VAR_FLT:    return variable_new_float(context, serial_decode_float(bits));
-        case VAR_FNC:    return variable_new_fnc(context, serial_decode_string(bits), NULL);
-        case VAR_STR:    return variable_new_str(context, serial_decode_string(bits));
-        case VAR_LST: {
-            uint32_t size = serial_decode_int(bits);
-            struct array *list = array_new_size(size);
-            while (size--)
-                array_add(list, variable_deserialize(context, bits));
-            struct variable *out = variable_new_list(context, list);
-            
-            uint32_t map_length = serial_decode_int(bits);
-            if (map_length) {
-                out->map = map_new();
-                for (int i=0; i<map_length; i++) {
-                    struct byte_array *key = serial_decode_string(bits);
-                    struct variable *value = variable_deserialize(context, bits);
-                    map_insert(out->map, key, value);
-                }
+    //DEBUGPRINT("\tserialize:%s\n", variable_value_str(context, (struct variable*)in));
+    variable_realize(context, (struct variable*)in);
+    struct serializer s = { // without bits, serialize into the context buffer, then copy it out once
+        .context = context,
+        .bits = bits ? bits : context_buffer(context),
+        .seen = mode != MODE_INDEXED ? map_new_ex(&ptr_compare, &ptr_hash, &ptr_copy, &ptr_del) : NULL,
+        .open = mode == MODE_INDEXED ? map_new_ex(&ptr_compare, &ptr_hash, &ptr_copy, &ptr_del) : NULL,
+        .ids = 0,
+        .indexed = mode == MODE_INDEXED,
+        .columns = mode == MODE_COLUMNS,
+        .apart = mode == MODE_COLUMNS && in->type == VAR_LST ? in->list : NULL,
+        .scope = NULL
+    };
+    if (s.indexed && (in->type == VAR_LST || in->type == VAR_MAP))
+        serialize_indexed(&s, in); // however small, so it loads lazily
+    else
+        serialize_variable(&s, in, withType);
+    if (s.seen)
+        map_del(s.seen);
+    if (s.open)
+        map_del(s.open);
+    if (bits)
+        return bits;
+
+    struct byte_array *exact = byte_array_new_size(s.bits->length);
+    if (exact->length)
+        memcpy(exact->data, s.bits->data, exact->length);
+    return exact;
+}
+
+struct byte_array *variable_serialize(struct context *context,
+									  struct byte_array *bits,
+                                      const struct variable *in,
+                                      bool withType)
+{
+    return variable_serialize2(context, bits, in, withType, MODE_SHARED);
+}
+
+// for sys.save: a version, then in columns, or indexed for variable_deserialize_lazy
+struct byte_array *variable_save(struct context *context,
+                                 struct byte_array *bits,
+                                 const struct variable *in,
+                                 bool indexed,
+                                 bool compress)
+{
+    byte_array_add_byte(bits, SERIAL_MARK);
+    byte_array_add_byte(bits, SERIAL_VERSION);
+    enum SerialMode mode = indexed ? MODE_INDEXED : MODE_COLUMNS;
+    if (!compress)
+        return variable_serialize2(context, bits, in, true, mode);
+    struct byte_array *raw = variable_serialize2(context, byte_array_new(), in, true, mode);
+    serial_compress(bits, raw);
+    byte_array_del(raw);
+    return bits;
+}
+
+// the uncompressed contents of a compressed save, else NULL
+struct byte_array *variable_unpack(struct context *context, struct byte_array *bits)
+{
+    if (bits->length < 3 || bits->data[0] != SERIAL_MARK || bits->data[2] != COMPRESSED_MAGIC)
+        return NULL;
+    bits->current = bits->data + 2;
+    struct byte_array *raw = serial_decompress(bits);
+    vm_assert(context, raw, "bad compressed save");
+    return raw;
+}
+
+static struct variable *deserialize_variable(struct deserializer *d);
+
+#define STREAM_BUFFER   65536
+#define STREAM_INT_MAX  5 // bytes in the longest encoded int
+
+// when streaming, reads until want bytes are ready, and fails with fewer than least
+static void deserialize_need(struct deserializer *d, uint32_t want, uint32_t least)
+{
+    struct byte_array *bits = d->bits;
+    uint32_t have = (uint32_t)(bits->data + bits->length - bits->current);
+    if (d->fd < 0 || have >= want)
+        return;
+
+    memmove(bits->data, bits->current, have);
+    bits->current = bits->data;
+    if (want > bits->capacity) // something bigger than the buffer
+        byte_array_resize(bits, want);
+    while (have < want) {
+        ssize_t got = read(d->fd, bits->data + have, bits->capacity - have);
+        vm_assert(d->context, got >= 0, "can't read stream");
+        if (!got)
+            break;
+        have += (uint32_t)got;
+    }
+    bits->length = have;
+    vm_assert(d->context, have >= least, "truncated stream");
+}
+
+static int32_t deserialize_int(struct deserializer *d)
+{
+    deserialize_need(d, STREAM_INT_MAX, 1);
+    return serial_decode_int(d->bits);
+}
+
+static struct byte_array *deserialize_string(struct deserializer *d)
+{
+    if (d->fd < 0)
+        return serial_decode_string(d->bits);
+    int32_t len = deserialize_int(d);
+    vm_assert(d->context, len >= 0, "negative length");
+    deserialize_need(d, len, len);
+    struct byte_array *str = byte_array_new_size(len);
+    memcpy(str->data, d->bits->current, len);
+    d->bits->current += len;
+    return str;
+}
+
+// the object for a back reference n < 0
+static void *deserialize_seen(struct deserializer *d, int32_t n)
+{
+    uint32_t id = -(n + 1);
+    vm_assert(d->context, d->seen, "bad reference");
+    vm_assert(d->context, id >= d->base, "can't stream a value shared across elements");
+    id -= d->base;
+    vm_assert(d->context, id < d->seen->length, "bad reference");
+    return array_get(d->seen, id);
+}
+
+static struct map *deserialize_map(struct deserializer *d)
+{
+    int32_t n = deserialize_int(d);
+    if (n < 0)
+        return (struct map*)deserialize_seen(d, n);
+    if (!n)
+        return NULL;
+    struct map *map = map_new();
+    if (d->seen)
+        array_add(d->seen, map);
+    while (n--) {
+        struct byte_array *key = deserialize_string(d);
+        map_insert(map, key, deserialize_variable(d));
+        byte_array_del(key);
+    }
+    return map;
+}
+
+static struct array *deserialize_list(struct deserializer *d)
+{
+    int32_t n = deserialize_int(d);
+    if (n < 0)
+        return (struct array*)deserialize_seen(d, n);
+    struct array *list = array_new_size(n);
+    if (d->seen)
+        array_add(d->seen, list);
+    while (n--)
+        array_add(list, deserialize_variable(d));
+    return list;
+}
+
+// the element or value at offset from body, decoded once per lazy list
+static struct variable *deserialize_child(struct deserializer *d, uint32_t body, uint32_t offset)
+{
+    struct byte_array *bits = d->bits;
+    vm_assert(d->context, offset < bits->length - body, "bad index");
+    void *at = (void*)(VOID_INT)(body + offset);
+    struct variable *child = d->cache ? (struct variable*)map_get(d->cache, at) : NULL;
+    if (child)
+        return child;
+    bits->current = bits->data + body + offset;
+    child = deserialize_variable(d);
+    if (d->cache)
+        map_insert(d->cache, at, child);
+    return child;
+}
+
+// after a hashed map length, skips the table and returns where it starts, with its size
+static uint32_t deserialize_table(struct deserializer *d, bool hashed, uint32_t *slots)
+{
+    struct byte_array *bits = d->bits;
+    *slots = 0;
+    if (!hashed)
+        return 0;
+    int32_t n = serial_decode_int(bits);
+    uint32_t table = (uint32_t)(bits->current - bits->data);
+    vm_assert(d->context, n > 0 && !(n & (n - 1)) && n <= (bits->length - table) / INDEX_WIDTH, "bad index");
+    bits->current += n * INDEX_WIDTH;
+    *slots = n;
+    return table;
+}
+
+// the index of an indexed list or map, then its elements and values
+static void deserialize_body(struct deserializer *d, uint32_t body, bool hashed,
+                             struct array **list, struct map **map)
+{
+    struct byte_array *bits = d->bits;
+    bits->current = bits->data + body;
+    int32_t n = serial_decode_int(bits);
+    uint32_t items = (uint32_t)(bits->current - bits->data);
+    vm_assert(d->context, n >= 0 && (list || !n), "bad index");
+    vm_assert(d->context, n <= (bits->length - items) / INDEX_WIDTH, "bad index");
+    bits->current += n * INDEX_WIDTH;
+    int32_t m = serial_decode_int(bits);
+    uint32_t slots;
+    deserialize_table(d, hashed, &slots);
+    uint32_t entry = (uint32_t)(bits->current - bits->data);
+    vm_assert(d->context, m >= 0, "bad index");
+
+    if (list) {
+        *list = array_new_size(n);
+        for (int32_t i=0; i<n; i++)
+            array_add(*list, deserialize_child(d, body, index_get(bits, items + i * INDEX_WIDTH)));
+    }
+    *map = m ? map_new() : NULL;
+    while (m--) {
+        bits->current = bits->data + entry;
+        struct byte_array *key = serial_decode_string(bits);
+        uint32_t offset = index_get(bits, (uint32_t)(bits->current - bits->data));
+        entry = (uint32_t)(bits->current - bits->data) + INDEX_WIDTH;
+        map_insert(*map, key, deserialize_child(d, body, offset));
+        byte_array_del(key);
+    }
+}
+
+static struct variable *deserialize_indexed(struct deserializer *d, enum VarType vt, bool hashed)
+{
+    struct context *context = d->context;
+    struct byte_array *bits = d->bits;
+    vm_assert(context, d->fd < 0, "can't stream an indexed list");
+    vm_assert(context, vt == VAR_LST || vt == VAR_MAP, "bad indexed type");
+    uint32_t body = (uint32_t)(bits->current - bits->data) + INDEX_WIDTH;
+    vm_assert(context, body <= bits->length, "bad index");
+    uint32_t size = index_get(bits, body - INDEX_WIDTH);
+    vm_assert(context, size <= bits->length - body, "bad index");
+
+    struct variable *out;
+    if (d->lazy) {
+        out = variable_new(context, VAR_LAZY);
+        out->lazy = (struct lazy*)malloc(sizeof(struct lazy));
+        *out->lazy = (struct lazy) {
+            .bits = bits,
+            .body = body,
+            .type = vt,
+            .hashed = hashed
+        };
+    } else {
+        out = variable_new(context, vt);
+        if (d->seen)
+            array_add(d->seen, out);
+        deserialize_body(d, body, hashed, vt == VAR_LST ? &out->list : NULL, &out->map);
+    }
+    bits->current = bits->data + body + size;
+    return out;
+}
+
+// the keys of a list of records
+static struct array *deserialize_keys(struct deserializer *d)
+{
+    int32_t k = deserialize_int(d);
+    vm_assert(d->context, k > 0, "bad record keys");
+    struct array *keys = array_new_size(k);
+    while (k--) {
+        struct byte_array *key = deserialize_string(d);
+        array_add(keys, byte_array_intern(d->context->interns, key));
+        byte_array_del(key);
+    }
+    return keys;
+}
+
+// n empty records, added to into
+static void deserialize_rows(struct deserializer *d, uint32_t n, struct array *into)
+{
+    while (n--) {
+        struct variable *row = variable_new(d->context, VAR_LST);
+        row->list = array_new();
+        row->map = map_new();
+        array_add(into, row);
+        if (d->seen) {
+            array_add(d->seen, row);
+            array_add(d->seen, row->list);
+            array_add(d->seen, row->map);
+        }
+    }
+}
+
+// the fields of rows records, by key, from into[first]
+static void deserialize_group(struct deserializer *d, const struct array *keys,
+                              uint32_t first, uint32_t rows, struct array *into)
+{
+    struct context *context = d->context;
+
+    for (uint32_t j=0; j<keys->length; j++) {
+        const void *key = array_get(keys, j);
+        enum Column kind = (enum Column)deserialize_int(d);
+        struct array *words = NULL;
+        if (kind == COLUMN_DICT) {
+            int32_t n = deserialize_int(d);
+            vm_assert(context, n > 0, "bad dictionary");
+            words = array_new_size(n);
+            while (n--)
+                array_add(words, d->view ? serial_decode_slice(d->bits) : deserialize_string(d));
+        }
+        int32_t previous = 0;
+        for (uint32_t i=0; i<rows; i++) {
+            struct variable *field;
+            switch (kind) {
+                case COLUMN_INT:
+                    previous = (int32_t)((uint32_t)previous + (uint32_t)deserialize_int(d));
+                    field = variable_new_int(context, previous);
+                    break;
+                case COLUMN_STR:
+                    field = variable_new_str(context, d->view ? serial_decode_slice(d->bits) : deserialize_string(d));
+                    break;
+                case COLUMN_DICT: {
+                    int32_t w = deserialize_int(d);
+                    vm_assert(context, w >= 0 && w < words->length, "bad dictionary index");
+                    field = variable_new_str(context, byte_array_share((struct byte_array*)array_get(words, w)));
+                } break;
+                case COLUMN_ANY:
+                    field = deserialize_variable(d);
+                    break;
+                default:
+                    vm_exit_message(context, "bad column");
+                    return;
             }
-            return out;
+            struct variable *row = (struct variable*)array_get(into, first + i);
+            map_insert(row->map, key, field);
         }
+        if (words) {
+            for (uint32_t w=0; w<words->length; w++)
+                byte_array_del((struct byte_array*)array_get(words, w));
+            words->length = 0;
+            array_del(words);
+        }
+    }
+}
+
+static struct variable *deserialize_records(struct deserializer *d)
+{
+    int32_t n = deserialize_int(d);
+    vm_assert(d->context, n >= 0, "bad list length");
+    struct variable *out = variable_new(d->context, VAR_LST);
+    out->list = array_new_size(n);
+    if (d->seen) {
+        array_add(d->seen, out);
+        array_add(d->seen, out->list);
+    }
+    struct array *keys = deserialize_keys(d);
+    deserialize_rows(d, n, out->list);
+    for (uint32_t start=0; start<(uint32_t)n; start += COLUMN_ROWS)
+        deserialize_group(d, keys, start, n - start > COLUMN_ROWS ? COLUMN_ROWS : n - start, out->list);
+    keys->length = 0; // interned
+    array_del(keys);
+    out->map = deserialize_map(d);
+    return out;
+}
+
+// skips the header of sys.save
+static void deserialize_version(struct deserializer *d)
+{
+    deserialize_need(d, 2, 0);
+    struct byte_array *bits = d->bits;
+    if (bits->data + bits->length - bits->current < 2 || *bits->current != SERIAL_MARK)
+        return;
+    vm_assert(d->context, bits->current[1] <= SERIAL_VERSION, "saved by a newer version");
+    bits->current += 2;
+}
+
+static struct variable *deserialize_variable(struct deserializer *d)
+{
+    struct context *context = d->context;
+    struct byte_array *bits = d->bits;
+    int32_t tag = deserialize_int(d);
+    if (tag < 0)
+        return (struct variable*)deserialize_seen(d, tag);
+    if (tag == (VAR_LST | SERIAL_COLUMNS))
+        return deserialize_records(d);
+    if (tag & SERIAL_INDEXED)
+        return deserialize_indexed(d, (enum VarType)(tag & ~(SERIAL_INDEXED | SERIAL_HASHED)),
+                                   tag & SERIAL_HASHED);
+
+    enum VarType vt = (enum VarType)(tag & ~SERIAL_MAPPED);
+    struct variable *out = variable_new(context, vt);
+    if (d->seen)
+        array_add(d->seen, out);
+    switch (vt) {
+        case VAR_NIL:                                                       break;
+        case VAR_INT:   out->integer = deserialize_int(d);                  break;
+        case VAR_BOOL:  out->boolean = deserialize_int(d);                  break;
+        case VAR_FLT:
+            deserialize_need(d, sizeof(float), sizeof(float));
+            out->floater = serial_decode_float(bits);
+            break;
+        case VAR_STR:
+        case VAR_FNC:
+        case VAR_ERR:
+        case VAR_BYT:
+            out->str = d->view ? serial_decode_slice(bits) : deserialize_string(d);
+            if (vt == VAR_FNC) // so run's reserve covers it, like compiled code
+                verify(context, out->str);
+            break;
+        case VAR_INTS:
+        case VAR_FLTS: // copied even from a view, to align the elements
+            out->str = deserialize_string(d);
+            vm_assert(d->context, !(out->str->length % PACKED_WIDTH), "bad packed length");
+            break;
+        case VAR_LST:   out->list = deserialize_list(d);                    break;
+        case VAR_MAP:                                                       break;
+        case VAR_C: {
+            struct byte_array *name = deserialize_string(d);
+            out->cfnc = sys_c_func(byte_array_to_string(name));
+            vm_assert(context, out->cfnc, "unknown c-function %s", byte_array_to_string(name));
+            byte_array_del(name);
+        } break;
         default:
             vm_exit_message(context, "bad var type");
             return NULL;
     }
+    if ((tag & SERIAL_MAPPED) || vt == VAR_LST || vt == VAR_MAP)
+        out->map = deserialize_map(d);
+    return out;
+}
+
+static struct variable *variable_deserialize2(struct context *context, struct byte_array *bits, bool view)
+{
+	null_check(context);
+    struct deserializer d = {
+        .context = context,
+        .bits = bits,
+        .seen = array_new(),
+        .base = 0,
+        .view = view,
+        .fd = -1,
+        .lazy = false,
+        .cache = NULL
+    };
+    deserialize_version(&d);
+    struct variable *out = deserialize_variable(&d);
+    d.seen->length = 0; // keep the contents
+    array_del(d.seen);
+    return out;
+}
+
+struct variable *variable_deserialize(struct context *context, struct byte_array *bits)
+{
+    return variable_deserialize2(context, bits, false);
+}
+
+// strings share bits' bytes, so heap bits stay alive by refcount; borrowed bits must outlive the result
+struct variable *variable_deserialize_view(struct context *context, struct byte_array *bits)
+{
+    return variable_deserialize2(context, bits, true);
+}
+
+// lazy ////////////////////////////////////////////////////////////////////
+
+// a VAR_LAZY for bits saved indexed by variable_save, else NULL;
+// bits must outlive it
+struct variable *variable_deserialize_lazy(struct context *context, struct byte_array *bits)
+{
+	null_check(context);
+    byte_array_reset(bits);
+    struct deserializer d = {
+        .context = context,
+        .bits = bits,
+        .seen = NULL,
+        .base = 0,
+        .view = true,
+        .fd = -1,
+        .lazy = true,
+        .cache = NULL
+    };
+    deserialize_version(&d);
+    uint8_t *start = bits->current;
+    int32_t tag = start < bits->data + bits->length ? serial_decode_int(bits) : 0;
+    bits->current = start;
+    if (tag <= 0 || (tag & SERIAL_COLUMNS) || !(tag & SERIAL_INDEXED)) {
+        byte_array_reset(bits);
+        return NULL;
+    }
+    return deserialize_variable(&d);
+}
+
+static struct deserializer lazy_deserializer(struct context *context, struct lazy *lazy)
+{
+    if (!lazy->cache)
+        lazy->cache = map_new_ex(&ptr_compare, &ptr_hash, &ptr_copy, &ptr_del);
+    return (struct deserializer) {
+        .context = context,
+        .bits = lazy->bits,
+        .seen = NULL,
+        .base = 0,
+        .view = true,
+        .fd = -1,
+        .lazy = true,
+        .cache = lazy->cache
+    };
+}
+
+// decodes one level, in place, for anything that needs the whole list;
+// every copy of v shares the result
+void variable_realize(struct context *context, struct variable *v)
+{
+    if (v->type != VAR_LAZY)
+        return;
+    struct lazy *lazy = v->lazy;
+    if (!lazy->real) {
+        struct deserializer d = lazy_deserializer(context, lazy);
+        deserialize_body(&d, lazy->body, lazy->hashed, lazy->type == VAR_LST ? &lazy->list : NULL, &lazy->map);
+        map_del(lazy->cache);
+        lazy->cache = NULL;
+        lazy->real = true;
+    }
+    v->type = lazy->type;
+    if (v->type == VAR_LST)
+        v->list = lazy->list;
+    v->map = lazy->map;
+}
+
+// the element at index, or NULL if v had to be realized
+struct variable *variable_lazy_item(struct context *context, struct variable *v, uint32_t index)
+{
+    struct lazy *lazy = v->lazy;
+    if (lazy->real) {
+        variable_realize(context, v);
+        return NULL;
+    }
+    struct byte_array *bits = lazy->bits;
+    bits->current = bits->data + lazy->body;
+    int32_t n = serial_decode_int(bits);
+    if (n < 0 || index >= (uint32_t)n)
+        return variable_new_nil(context);
+    uint32_t items = (uint32_t)(bits->current - bits->data);
+    struct deserializer d = lazy_deserializer(context, lazy);
+    return deserialize_child(&d, lazy->body, index_get(bits, items + index * INDEX_WIDTH));
+}
+
+// the value for key, or NULL if there is none or v had to be realized
+struct variable *variable_lazy_key(struct context *context, struct variable *v, const struct byte_array *key)
+{
+    struct lazy *lazy = v->lazy;
+    if (lazy->real) {
+        variable_realize(context, v);
+        return NULL;
+    }
+    struct byte_array *bits = lazy->bits;
+    bits->current = bits->data + lazy->body;
+    int32_t n = serial_decode_int(bits);
+    bits->current += n * INDEX_WIDTH;
+    int32_t m = serial_decode_int(bits);
+    struct deserializer d = lazy_deserializer(context, lazy);
+    uint32_t slots;
+    uint32_t table = deserialize_table(&d, lazy->hashed, &slots);
+    if (slots) {
+        uint32_t slot = (uint32_t)hash_bytes(key->data, key->length, 0);
+        for (uint32_t probes = 0; probes < slots; probes++, slot++) {
+            slot &= slots - 1;
+            uint32_t at = index_get(bits, table + slot * INDEX_WIDTH);
+            if (at == HASH_EMPTY)
+                return NULL;
+            vm_assert(context, at < bits->length - lazy->body, "bad index");
+            bits->current = bits->data + lazy->body + at;
+            int32_t length = serial_decode_int(bits);
+            if (length == key->length && !memcmp(bits->current, key->data, length)) {
+                uint32_t offset = index_get(bits, (uint32_t)(bits->current + length - bits->data));
+                return deserialize_child(&d, lazy->body, offset);
+            }
+        }
+        return NULL;
+    }
+    for (; m > 0; m--) {
+        int32_t length = serial_decode_int(bits);
+        bool found = length == key->length && !memcmp(bits->current, key->data, length);
+        bits->current += length;
+        uint32_t offset = index_get(bits, (uint32_t)(bits->current - bits->data));
+        bits->current += INDEX_WIDTH;
+        if (found)
+            return deserialize_child(&d, lazy->body, offset);
+    }
+    return NULL;
+}
+
+static uint32_t variable_lazy_length(const struct variable *v)
+{
+    struct lazy *lazy = v->lazy;
+    if (lazy->real)
+        return lazy->list ? lazy->list->length : 0;
+    struct byte_array *bits = lazy->bits;
+    bits->current = bits->data + lazy->body;
+    return serial_decode_int(bits);
+}
+
+// streaming /////////////////////////////////////////////////////////////////
+
+// decodes a serialized list one element at a time, through a fixed buffer
+struct variable_stream {
+    struct deserializer d;
+    uint32_t remaining;
+    struct array *keys;         // of a list of records, else NULL
+    struct array *rows;         // decoded from the current group
+    uint32_t row;
+};
+
+struct variable_stream *variable_stream_new(struct context *context, int fd)
+{
+	null_check(context);
+    struct variable_stream *stream = (struct variable_stream*)malloc(sizeof(struct variable_stream));
+    stream->d = (struct deserializer) {
+        .context = context,
+        .bits = byte_array_new_size(STREAM_BUFFER),
+        .seen = array_new(),
+        .base = 2, // the list's variable and array
+        .view = false,
+        .fd = fd,
+        .lazy = false,
+        .cache = NULL
+    };
+    stream->d.bits->length = 0;
+    stream->keys = stream->rows = NULL;
+
+    // the stream owns fd, so a bad header closes it along with the stream
+    jmp_buf outer;
+    memcpy(outer, trying, sizeof(jmp_buf));
+    if (setjmp(trying)) {
+        variable_stream_del(stream);
+        memcpy(trying, outer, sizeof(jmp_buf));
+        longjmp(trying, 1);
+    }
+
+    deserialize_version(&stream->d);
+    int32_t tag = deserialize_int(&stream->d);
+    vm_assert(context, tag >= 0, "can't stream a compressed save");
+    bool records = tag == (VAR_LST | SERIAL_COLUMNS);
+    vm_assert(context, records || (tag & ~SERIAL_MAPPED) == VAR_LST, "can only stream a list");
+    int32_t n = deserialize_int(&stream->d);
+    vm_assert(context, n >= 0, "bad list length");
+    stream->remaining = n;
+    stream->keys = records ? deserialize_keys(&stream->d) : NULL;
+    if (records) // the rows come first, and can't be referred to
+        stream->d.base += 3 * n;
+    stream->rows = records ? array_new() : NULL;
+    stream->row = 0;
+    memcpy(trying, outer, sizeof(jmp_buf));
+    return stream;
+}
+
+// the next element, or NULL after the last
+struct variable *variable_stream_next(struct variable_stream *stream)
+{
+    if (!stream->remaining)
+        return NULL;
+    struct deserializer *d = &stream->d;
+    d->seen->length = 0; // keep the contents
+    struct variable *out;
+    if (stream->keys) {
+        struct array *rows = stream->rows;
+        if (stream->row == rows->length) {
+            rows->length = stream->row = 0;
+            uint32_t group = stream->remaining > COLUMN_ROWS ? COLUMN_ROWS : stream->remaining;
+            deserialize_rows(d, group, rows);
+            d->seen->length = 0; // numbered before base
+            deserialize_group(d, stream->keys, 0, group, rows);
+        }
+        out = (struct variable*)array_get(rows, stream->row++);
+    } else
+        out = deserialize_variable(d);
+    d->base += d->seen->length;
+    stream->remaining--;
+    return out;
+}
+
+void variable_stream_del(struct variable_stream *stream)
+{
+    if (stream->keys) {
+        stream->keys->length = 0;
+        array_del(stream->keys);
+    }
+    if (stream->rows) {
+        stream->rows->length = 0;
+        array_del(stream->rows);
+    }
+    stream->d.seen->length = 0;
+    array_del(stream->d.seen);
+    byte_array_del(stream->d.bits);
+    close(stream->d.fd);
+    free(stream);
 }
 
 uint32_t variable_length(struct context *context, const struct variable *v)
@@ -421,6 +1652,9 @@ uint32_t variable_length(struct context *context, const struct variable *v)
     switch (v->type) {
         case VAR_LST: return v->list->length;
         case VAR_STR: return v->str->length;
+        case VAR_INTS:
+        case VAR_FLTS: return PACKED_LENGTH(v);
+        case VAR_LAZY: return variable_lazy_length(v);
         case VAR_INT: return v->integer;
         case VAR_NIL: return 0;
         default:
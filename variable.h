@@ -14,8 +14,23 @@ enum VarType {
     VAR_ERR,
     VAR_BYT,
     VAR_C,
+    VAR_INTS,
+    VAR_FLTS,
+    VAR_LAZY,
 };    
 
+// VAR_INTS and VAR_FLTS pack int32 or float32 elements into str, unboxed
+// VAR_LAZY is a list still in its serialized form, decoded as it is indexed
+
+#define PACKED_WIDTH    4 // bytes per element
+#define PACKED_LANES    4 // elements per vector
+#define PACKED_LENGTH(v) ((v)->str->length / PACKED_WIDTH)
+
+#ifdef __GNUC__
+typedef int32_t packed_ints __attribute__((vector_size(PACKED_LANES * PACKED_WIDTH)));
+typedef float packed_floats __attribute__((vector_size(PACKED_LANES * PACKED_WIDTH)));
+#endif
+
 enum Visited {
     VISITED_NOT,
     VISITED_ONCE,
@@ -38,6 +53,7 @@ struct variable {
         float floater;
         bool boolean;
         struct variable*(*cfnc)(context_p);
+        struct lazy *lazy;
     };
     struct map *map;
 };
@@ -46,10 +62,28 @@ struct variable* variable_new(struct context *context, enum VarType type);
 void variable_del(struct context *context, struct variable *v);
 struct byte_array* variable_value(struct context *context, struct variable* v);
 const char* variable_value_str(struct context *context, struct variable* v);
+const char* variable_trace_str(struct context *context, struct variable* v);
 struct byte_array *variable_serialize(struct context *context, struct byte_array *bits,
                                       const struct variable *in,
                                       bool withType);
 struct variable *variable_deserialize(struct context *context, struct byte_array *str);
+struct variable *variable_deserialize_view(struct context *context, struct byte_array *bits);
+
+struct byte_array *variable_save(struct context *context,
+                                 struct byte_array *bits,
+                                 const struct variable *in,
+                                 bool indexed,
+                                 bool compress);
+struct byte_array *variable_unpack(struct context *context, struct byte_array *bits);
+struct variable *variable_deserialize_lazy(struct context *context, struct byte_array *bits);
+struct variable *variable_lazy_item(struct context *context, struct variable *v, uint32_t index);
+struct variable *variable_lazy_key(struct context *context, struct variable *v, const struct byte_array *key);
+void variable_realize(struct context *context, struct variable *v);
+
+struct variable_stream;
+struct variable_stream *variable_stream_new(struct context *context, int fd);
+struct variable *variable_stream_next(struct variable_stream *stream);
+void variable_stream_del(struct variable_stream *stream);
 
 struct variable* variable_new_bool(struct context *context, bool b);
 struct variable *variable_new_err(struct context *context, const char* message);
@@ -63,6 +97,11 @@ struct variable *variable_new_fnc(struct context *context, struct byte_array *bo
 struct variable *variable_new_list(struct context *context, struct array *list);
 struct variable *variable_new_src(struct context *context, uint32_t size);
 struct variable *variable_new_bytes(struct context *context, struct byte_array *bytes, uint32_t size);
+struct variable *variable_new_packed(struct context *context, enum VarType type, uint32_t length);
+struct variable *variable_packed_from(struct context *context, enum VarType type, const struct variable *from);
+struct variable *variable_packed_get(struct context *context, const struct variable *v, uint32_t index);
+void variable_packed_set(struct context *context, struct variable *v, uint32_t index, const struct variable *value);
+struct variable *variable_packed_list(struct context *context, const struct variable *v);
 
 struct variable *variable_copy(struct context *context, const struct variable *v);
 struct variable *variable_pop(struct context *context);
@@ -28,6 +28,7 @@ void lookup(struct context *context, struct variable *indexable, struct variable
 #endif // not DEBUG
 
 #define RESERVED_SET    "set"
+#define RESERVED_NEXT   "next"
 
 // assertions //////////////////////////////////////////////////////////////
 
@@ -97,6 +98,12 @@ static inline void cfnc_length(struct context *context) {
     stack_push(context->operand_stack, result);
 }
 
+// keys of context->names, which are addresses in byte code
+static bool code_compare(const void *a, const void *b) { return a == b; }
+static int32_t code_hash(const void *p) { return (int32_t)(VOID_INT)p; }
+static void *code_copy(const void *p) { return (void*)p; }
+static void code_del(const void *p) {}
+
 struct context *context_new(bool state)
 {
     struct context *context = (struct context*)malloc(sizeof(struct context));
@@ -106,13 +113,29 @@ struct context *context_new(bool state)
         stack_push(context->program_stack, program_state_new(context, NULL));
     context->operand_stack = stack_new();
     context->vm_exception = NULL;
+    context->find = NULL;
+    context->interns = map_new();
+    context->names = map_new_ex(&code_compare, &code_hash, &code_copy, &code_del);
+    context->error = NULL;
     context->runtime = true;
     context->num_vars = 0;
     context->indent = 0;
+    context->sort_parallel = SORT_PARALLEL;
+    context->sort_threads = cpu_count();
+    context->buffer = byte_array_new();
 
     return context;
 }
 
+// empties and returns the context's buffer, which keeps its capacity
+struct byte_array *context_buffer(struct context *context)
+{
+    struct byte_array *buffer = context->buffer;
+    byte_array_resize(buffer, 0);
+    byte_array_reset(buffer);
+    return buffer;
+}
+
 // garbage collection //////////////////////////////////////////////////////
 
 void sweep(struct context *context, struct variable *root)
@@ -187,7 +210,7 @@ void print_operand_stack(struct context *context)
     null_check(context);
     struct variable *operand;
     for (int i=0; (operand = stack_peek(context->operand_stack, i)); i++)
-        DEBUGPRINT("\t%s\n", variable_value_str(context, operand));
+        DEBUGPRINT("\t%s\n", variable_trace_str(context, operand));
 }
 
 const char* indentation(struct context *context)
@@ -246,6 +269,340 @@ const char* indentation(struct context *context) { return ""; }
 
 #endif // DEBUG
 
+// verification ////////////////////////////////////////////////////////////
+
+// what the verifier knows about an operand stack slot
+enum Slot {
+    SLOT_VAL,   // a single value
+    SLOT_SRC,   // a set of values, from VM_SRC or a call
+    SLOT_ANY,   // either, e.g. the result of a custom getter
+    SLOT_MAYBE, // an ANY that VM_SET may or may not have consumed
+};
+
+struct verifier {
+    struct context *context;
+    const uint8_t *code;
+    uint32_t length;
+    uint32_t pc;
+    uint32_t depth;
+    uint32_t max;
+    uint8_t *slots;         // kind of each operand stack slot
+    uint32_t *origins;      // for each slot, 1 + where its string literal is, or 0
+    int32_t *starts;        // stack depth where each instruction begins, or -1
+    int32_t *incoming;      // deepest stack jumped to each offset, or -1
+    uint8_t *incoming_slot; // kind of top slot jumped to each offset
+};
+
+static uint32_t verify_code(struct context *context, const uint8_t *code, uint32_t length);
+
+// deepest operand stack any verified block needs; not per context, since
+// functions verified in one, like an image's, can run in another
+static uint32_t max_depth = 0;
+
+static void verify_need(struct verifier *v, uint32_t bytes) {
+    vm_assert(v->context, v->pc + bytes <= v->length, "%s: truncated at %u", ERROR_VERIFY, v->pc);
+}
+
+// mirrors serial_decode_int, without reading past the end
+static int32_t verify_int(struct verifier *v)
+{
+    verify_need(v, 1);
+    bool neg = v->code[v->pc] & 0x40;
+    int32_t ret = v->code[v->pc] & 0x3F;
+    int bitpos = 6;
+    while ((v->code[v->pc++] & 0x80) && (bitpos < (sizeof(int32_t)*8))) {
+        verify_need(v, 1);
+        ret |= (v->code[v->pc] & 0x7F) << bitpos;
+        bitpos += 7;
+    }
+    return neg ? -ret : ret;
+}
+
+// returns the offset of the string's bytes
+static uint32_t verify_string(struct verifier *v, uint32_t *length)
+{
+    int32_t len = verify_int(v);
+    vm_assert(v->context, len >= 0, "%s: negative string length at %u", ERROR_VERIFY, v->pc);
+    verify_need(v, len);
+    uint32_t at = v->pc;
+    v->pc += len;
+    if (length)
+        *length = len;
+    return at;
+}
+
+static void verify_pop(struct verifier *v, uint32_t n)
+{
+    vm_assert(v->context, n <= v->depth, "%s: stack underflow at %u", ERROR_VERIFY, v->pc);
+    v->depth -= n;
+}
+
+static void verify_push(struct verifier *v, enum Slot slot)
+{
+    v->origins[v->depth] = 0;
+    v->slots[v->depth++] = slot;
+    if (v->depth > v->max)
+        v->max = v->depth;
+}
+
+// interns the string at operand at, for decode_name and push_str to find
+static void verify_intern(struct verifier *v, uint32_t at)
+{
+    uint32_t pc = v->pc, length;
+    v->pc = at;
+    uint32_t bytes = verify_string(v, &length);
+    v->pc = pc;
+    struct byte_array *view = byte_array_view((uint8_t*)v->code + bytes, length);
+    map_insert(v->context->names, v->code + at, byte_array_intern(v->context->interns, view));
+    byte_array_del(view);
+}
+
+static void verify_name(struct verifier *v)
+{
+    uint32_t at = v->pc;
+    verify_string(v, NULL);
+    verify_intern(v, at);
+}
+
+// a member name or map key, if it is a literal, is interned
+static void verify_key(struct verifier *v, uint32_t slot)
+{
+    if (slot < v->depth && v->origins[slot])
+        verify_intern(v, v->origins[slot] - 1);
+}
+
+static enum Slot verify_top(const struct verifier *v) {
+    return v->depth ? (enum Slot)v->slots[v->depth-1] : SLOT_VAL;
+}
+
+// a block run in the current frame, e.g. a loop body, sits on top of the current stack
+static void verify_nested(struct verifier *v)
+{
+    uint32_t length;
+    uint32_t at = verify_string(v, &length);
+    uint32_t nested = verify_code(v->context, v->code + at, length);
+    if (v->depth + nested > v->max)
+        v->max = v->depth + nested;
+}
+
+static void verify_jump(struct verifier *v, uint32_t from, int32_t offset, uint32_t depth, enum Slot top)
+{
+    int64_t target = (int64_t)from + offset;
+    vm_assert(v->context, target >= 0 && target <= v->length,
+              "%s: jump out of bounds at %u", ERROR_VERIFY, v->pc);
+    if (target < v->pc) { // backward, so already seen
+        vm_assert(v->context, v->starts[target] >= 0, "%s: jump into instruction at %u", ERROR_VERIFY, v->pc);
+        vm_assert(v->context, depth <= v->starts[target], "%s: stack grows in loop at %u", ERROR_VERIFY, v->pc);
+        return;
+    }
+    if (v->incoming[target] < 0)
+        v->incoming_slot[target] = top;
+    else if (v->incoming_slot[target] != top)
+        v->incoming_slot[target] = SLOT_ANY;
+    if ((int32_t)depth > v->incoming[target])
+        v->incoming[target] = depth;
+}
+
+// get_value: VM_SET consumes a single value, but only takes from a set of values
+static void verify_set(struct verifier *v)
+{
+    switch (verify_top(v)) {
+        case SLOT_VAL:  if (v->depth) verify_pop(v, 1);     break;
+        case SLOT_ANY:  v->slots[v->depth-1] = SLOT_MAYBE;  break;
+        default:                                            break;
+    }
+}
+
+static void verify_instruction(struct verifier *v)
+{
+    uint8_t inst = v->code[v->pc++];
+    bool really = inst & VM_RLY;
+    inst &= ~VM_RLY;
+    vm_assert(v->context, !really || inst == VM_GET || inst == VM_PUT || inst == VM_PTX || inst == VM_MET,
+              "%s: %u", ERROR_OPCODE, v->pc-1);
+
+    int32_t n;
+    uint32_t length;
+    switch (inst) {
+        case VM_NIL:    verify_push(v, SLOT_VAL);                               break;
+        case VM_INT:
+        case VM_BUL:    verify_int(v);      verify_push(v, SLOT_VAL);           break;
+        case VM_FLT:    verify_need(v, 4);  v->pc += 4; verify_push(v, SLOT_VAL); break;
+        case VM_STR: { // interned later if it turns out to be a key
+            uint32_t at = v->pc;
+            map_remove(v->context->names, v->code + at); // from code that was here before
+            verify_string(v, NULL);
+            verify_push(v, SLOT_VAL);
+            v->origins[v->depth-1] = at + 1;
+        } break;
+        case VM_VAR:    verify_name(v);     verify_push(v, SLOT_VAL);           break;
+        case VM_FNC: {
+            n = verify_int(v);
+            vm_assert(v->context, n >= 0, "%s: closures at %u", ERROR_VERIFY, v->pc);
+            while (n--)
+                verify_name(v);
+            uint32_t at = verify_string(v, &length);
+            uint32_t frame = verify_code(v->context, v->code + at, length);
+            if (frame > max_depth)
+                max_depth = frame;
+            verify_push(v, SLOT_VAL);
+        } break;
+        case VM_SRC:
+        case VM_LST:
+        case VM_MAP:
+        case VM_RET:
+            n = verify_int(v);
+            vm_assert(v->context, n >= 0, "%s: count at %u", ERROR_VERIFY, v->pc);
+            for (int32_t i=0; inst == VM_MAP && i<n; i++)
+                verify_key(v, v->depth - 2*(n-i));
+            verify_pop(v, inst == VM_MAP ? 2*n : n);
+            verify_push(v, inst == VM_SRC || inst == VM_RET ? SLOT_SRC : SLOT_VAL);
+            break;
+        case VM_CAL:
+        case VM_MET:
+            n = verify_int(v);
+            vm_assert(v->context, n >= 0, "%s: count at %u", ERROR_VERIFY, v->pc);
+            if (inst == VM_MET)
+                verify_key(v, v->depth - 1);
+            verify_pop(v, n + (inst == VM_MET ? 2 : 1));
+            verify_push(v, SLOT_SRC);
+            break;
+        case VM_GET:    verify_key(v, v->depth - 1); verify_pop(v, 2); verify_push(v, SLOT_ANY); break;
+        case VM_PUT:    verify_key(v, v->depth - 1); verify_pop(v, 2); verify_set(v);            break;
+        case VM_PTX:    verify_key(v, v->depth - 1); verify_pop(v, 2);                           break;
+        case VM_SET:    verify_name(v);     verify_set(v);                      break;
+        case VM_STX:    verify_name(v);                                         break;
+        case VM_DST:
+            if (verify_top(v) == SLOT_SRC || verify_top(v) == SLOT_MAYBE)
+                verify_pop(v, 1);
+            break;
+        case VM_EQU: case VM_NEQ: case VM_GTN: case VM_LTN: case VM_GRQ: case VM_LEQ:
+        case VM_ADD: case VM_SUB: case VM_MUL: case VM_DIV: case VM_MOD:
+        case VM_BND: case VM_BOR: case VM_INV: case VM_XOR: case VM_RSF: case VM_LSF:
+            verify_pop(v, 2);
+            verify_push(v, SLOT_VAL);
+            break;
+        case VM_NEG:
+        case VM_NOT:    verify_pop(v, 1); verify_push(v, SLOT_VAL);             break;
+        case VM_TRO:    verify_pop(v, 1);                                       break;
+        case VM_AND:
+        case VM_ORR:    // short circuit keeps the operand
+            n = verify_int(v);
+            verify_pop(v, 1);
+            verify_jump(v, v->pc, n, v->depth + 1, SLOT_VAL);
+            break;
+        case VM_IFF:
+            n = verify_int(v);
+            verify_pop(v, 1);
+            verify_jump(v, v->pc, n, v->depth, verify_top(v));
+            break;
+        case VM_JMP: {
+            uint32_t from = v->pc - 1;
+            n = verify_int(v);
+            verify_jump(v, n < 0 ? from : v->pc, n, v->depth, verify_top(v));
+        } break;
+        case VM_ITR:
+        case VM_COM:
+            verify_name(v);                     // who
+            verify_pop(v, 1);                   // what
+            verify_nested(v);                   // where
+            verify_nested(v);                   // how
+            if (inst == VM_COM)
+                verify_push(v, SLOT_VAL);
+            break;
+        case VM_TRY:
+            verify_nested(v);                   // trial
+            verify_name(v);                     // name
+            verify_nested(v);                   // catcher
+            break;
+        default:
+            vm_exit_message(v->context, "%s: %u", ERROR_OPCODE, v->pc-1);
+            break;
+    }
+}
+
+static void verify_free(struct verifier *v)
+{
+    free(v->slots);
+    free(v->origins);
+    free(v->starts);
+    free(v->incoming);
+    free(v->incoming_slot);
+}
+
+// checks one block of byte code and returns its maximum operand stack depth
+static uint32_t verify_code(struct context *context, const uint8_t *code, uint32_t length)
+{
+    struct verifier v = {
+        .context = context,
+        .code = code,
+        .length = length,
+        .slots = (uint8_t*)malloc(length + 1),
+        .origins = (uint32_t*)malloc((length + 1) * sizeof(uint32_t)),
+        .starts = (int32_t*)malloc((length + 1) * sizeof(int32_t)),
+        .incoming = (int32_t*)malloc((length + 1) * sizeof(int32_t)),
+        .incoming_slot = (uint8_t*)malloc(length + 1),
+    };
+    assert_message(v.slots && v.origins && v.starts && v.incoming && v.incoming_slot, ERROR_ALLOC);
+
+    // a failed check frees the buffers on its way out to the caller's setjmp
+    jmp_buf outer;
+    memcpy(outer, trying, sizeof(jmp_buf));
+    if (setjmp(trying)) {
+        verify_free(&v);
+        memcpy(trying, outer, sizeof(jmp_buf));
+        vm_exit();
+    }
+
+    for (uint32_t i=0; i<=length; i++)
+        v.incoming[i] = v.starts[i] = -1;
+
+    while (v.pc < length) {
+        if (v.incoming[v.pc] >= 0) { // join
+            if ((uint32_t)v.incoming[v.pc] > v.depth) {
+                for (uint32_t i = v.depth; i < (uint32_t)v.incoming[v.pc]; i++) {
+                    v.slots[i] = SLOT_ANY;
+                    v.origins[i] = 0;
+                }
+                v.depth = v.incoming[v.pc];
+            }
+            if (v.depth) {
+                v.slots[v.depth-1] = v.incoming_slot[v.pc] == verify_top(&v) ? verify_top(&v) : SLOT_ANY;
+                v.origins[v.depth-1] = 0; // may have come from elsewhere
+            }
+        }
+        v.starts[v.pc] = v.depth;
+        verify_instruction(&v);
+    }
+
+    for (uint32_t i=0; i<length; i++)
+        vm_assert(context, v.incoming[i] < 0 || v.starts[i] >= 0, "%s: jump into instruction at %u", ERROR_VERIFY, i);
+
+    memcpy(trying, outer, sizeof(jmp_buf));
+    verify_free(&v);
+    return v.max;
+}
+
+// checks byte code once before it runs, so the interpreter loop can trust it
+uint32_t verify(struct context *context, const struct byte_array *program)
+{
+    null_check(program);
+    uint32_t depth = verify_code(context, program->data, program->length);
+    if (depth > max_depth)
+        max_depth = depth;
+    return depth;
+}
+
+// forgets what verify interned for code whose bytes are about to be freed,
+// so that context->names only holds names for code that is still there
+void unverify(struct context *context, const struct byte_array *code)
+{
+    const uint8_t *from = code->shared ? code->shared->base : code->data;
+    uint32_t length = code->shared ? code->shared->used : code->length;
+    for (uint32_t i=0; i<length && context->names->length; i++)
+        map_remove(context->names, from + i);
+}
+
 // instruction implementations /////////////////////////////////////////////
 
 struct variable *src(struct context *context, enum Opcode op, struct byte_array *program)
@@ -255,7 +612,7 @@ struct variable *src(struct context *context, enum Opcode op, struct byte_array
     if (!context->runtime)
         return NULL;
     struct variable *v = variable_new_src(context, size);
-    stack_push(context->operand_stack, v);
+    variable_push(context, v);
     return v;
 }
 
@@ -280,6 +637,9 @@ void vm_call_src(struct context *context, struct variable *func)
             run(context, func->str, env, false);
             break;
         case VAR_C: {
+            // c-functions switch on VAR_LST, so they get loaded lists decoded
+            for (uint32_t i=0; i<s->list->length; i++)
+                variable_realize(context, (struct variable*)array_get(s->list, i));
             struct variable *v = func->cfnc(context);
             if (!v)
                 v = variable_new_src(context, 0);
@@ -316,7 +676,7 @@ void vm_call(struct context *context, struct variable *func, struct variable *ar
         for (; arg; arg = va_arg(argp, struct variable*))
             array_add(s->list, arg);
         va_end(argp);
-        variable_push(context, s);
+        stack_push(context->operand_stack, s);
     }
 
     vm_call_src(context, func);
@@ -363,21 +723,10 @@ static void push_list(struct context *context, struct byte_array *program)
     if (!context->runtime)
         VM_DEBUGPRINT("\n");
     struct array *items = array_new();
-
-    struct map *map = NULL;
-    while (num_items--) {
-        struct variable* v = variable_pop(context);
-        if (v->type == VAR_MAP) {
-            if (!map)
-                map = map_new(context, NULL);
-            map_update(map, v->map); // mapped values are stored in the map, not list
-        }
-        else
-            array_insert(items, 0, v);
-    }
-    struct variable *list = variable_new_list(context, items);
-    list->map = map;
-    DEBUGPRINT(": %s\n", variable_value_str(context, list));
+    while (num_items--)
+        array_insert(items, 0, variable_pop(context));
+    struct variable *list = variable_new_list(context, items); // mapped values go in the map, in order
+    DEBUGPRINT(": %s\n", variable_trace_str(context, list));
     variable_push(context, list);
 }
 
@@ -395,7 +744,7 @@ static void push_map(struct context *context, struct byte_array *program)
         map_insert(map, key->str, value);
     }
     struct variable *v = variable_new_map(context, map);
-    DEBUGPRINT(": %s\n", variable_value_str(context, v));
+    DEBUGPRINT(": %s\n", variable_trace_str(context, v));
     variable_push(context, v);
 }
 
@@ -411,10 +760,13 @@ struct variable* variable_set(struct context *context, struct variable *dst, con
         case VAR_C:     dst->cfnc = src->cfnc;                  break;
         case VAR_FNC:
         case VAR_BYT:
-        case VAR_STR:   dst->str = byte_array_copy(src->str);   break;
+        case VAR_INTS:
+        case VAR_FLTS:
+        case VAR_STR:   dst->str = byte_array_share(src->str);  break;
         case VAR_MAP:   dst->map = src->map;                    break;
         case VAR_SRC:
         case VAR_LST:   dst->list = src->list;                  break;
+        case VAR_LAZY:  dst->lazy = src->lazy;                  break;
         default:
             vm_exit_message(context, "bad var type");
             break;
@@ -455,6 +807,13 @@ static struct variable *list_get_int(struct context *context,
             sprintf(str, "%c", indexable->str->data[index]);
             return variable_new_str(context, byte_array_from_string(str));
         }
+        case VAR_INTS:
+        case VAR_FLTS:
+            return variable_packed_get(context, indexable, index);
+        case VAR_LAZY: {
+            struct variable *item = variable_lazy_item(context, (struct variable*)indexable, index);
+            return item ? item : list_get_int(context, indexable, index);
+        }
         default:
             vm_exit_message(context, "indexing non-indexable");
             return NULL;
@@ -491,7 +850,9 @@ void lookup(struct context *context, struct variable *indexable, struct variable
             item = list_get_int(context, indexable, index->integer);
             break;
         case VAR_STR:
-            if (indexable->map)
+            if (indexable->type == VAR_LAZY)
+                item = variable_lazy_key(context, indexable, index->str);
+            if (!item && indexable->map)
                 item = (struct variable*)map_get(indexable->map, index->str);
             if (!item)
                 item = builtin_method(context, indexable, index);
@@ -505,7 +866,7 @@ void lookup(struct context *context, struct variable *indexable, struct variable
             vm_exit_message(context, "bad index type");
             break;
     }
-    //    DEBUGPRINT(" found %s\n", variable_value_str(context, item));
+    //    DEBUGPRINT(" found %s\n", variable_trace_str(context, item));
     variable_push(context, item);
 }
 
@@ -592,6 +953,38 @@ static void push_float(struct context *context, struct byte_array *program)
     variable_push(context, var);
 }
 
+// the name or key verify interned for the operand at program's position,
+// skipping it, or NULL if verify didn't see it, e.g. in an image's function;
+// code that wasn't verified may sit where other code was, so the bytes must match
+static struct byte_array *verified_name(struct context *context, struct byte_array *program)
+{
+    struct byte_array *name = (struct byte_array*)map_get(context->names, program->current);
+    if (!name)
+        return NULL;
+    uint8_t *at = program->current;
+    int32_t length = serial_decode_int(program);
+    if (length != name->length ||
+        program->current + length > program->data + program->length ||
+        memcmp(program->current, name->data, length)) {
+        program->current = at;
+        return NULL;
+    }
+    program->current += length;
+    return name;
+}
+
+// a variable name from the byte code, interned
+static struct byte_array *decode_name(struct context *context, struct byte_array *program)
+{
+    struct byte_array *name = verified_name(context, program);
+    if (name)
+        return name;
+    struct byte_array *view = serial_decode_view(program);
+    name = byte_array_intern(context->interns, view);
+    byte_array_del(view);
+    return name;
+}
+
 struct variable *find_var(struct context *context, const struct byte_array *name)
 {
     null_check(name);
@@ -610,7 +1003,7 @@ struct variable *find_var(struct context *context, const struct byte_array *name
 
 static void push_var(struct context *context, struct byte_array *program)
 {
-    struct byte_array* name = serial_decode_string(program);
+    struct byte_array* name = decode_name(context, program);
     VM_DEBUGPRINT("VAR %s\n", byte_array_to_string(name));
     struct variable *v = find_var(context, name);
     if (!v)
@@ -619,9 +1012,16 @@ static void push_var(struct context *context, struct byte_array *program)
     variable_push(context, v);
 }
 
+// a key gets a view of its interned bytes, which keeps their hash
 static void push_str(struct context *context, struct byte_array *program)
 {
-    struct byte_array* str = serial_decode_string(program);
+    struct byte_array *key = verified_name(context, program);
+    struct byte_array *str;
+    if (key) {
+        str = byte_array_view(key->data, key->length);
+        str->hash = key->hash;
+    } else
+        str = serial_decode_view(program);
     VM_DEBUGPRINT("STR '%s'\n", byte_array_to_string(str));
     struct variable* v = variable_new_str(context, str);
     variable_push(context, v);
@@ -633,7 +1033,7 @@ static void push_fnc(struct context *context, struct byte_array *program)
     struct map *closures = NULL;
 
     for (int i=0; i<num_closures; i++) {
-        struct byte_array *name = serial_decode_string(program);
+        struct byte_array *name = decode_name(context, program);
         if (context->runtime) {
             if (!closures)
                 closures = map_new();
@@ -643,7 +1043,7 @@ static void push_fnc(struct context *context, struct byte_array *program)
         }
     }
 
-    struct byte_array *body = serial_decode_string(program);
+    struct byte_array *body = serial_decode_view(program);
 
     DEBUGPRINT("FNC %u,%u\n", num_closures, body->length);
     //display_code(context, body);
@@ -666,7 +1066,7 @@ void set_named_variable(struct context *context,
     struct variable *to_var = variable_copy(context, value);
     map_insert(var_map, name, to_var);
 
-    //DEBUGPRINT("SET %s to %s\n", byte_array_to_string(name), variable_value_str(context, value));
+    //DEBUGPRINT("SET %s to %s\n", byte_array_to_string(name), variable_trace_str(context, value));
     // DEBUGPRINT(" SET %s at %p in {p:%p, s:%p, m:%p}\n", byte_array_to_string(name), to_var, context->program_stack, state, var_map);
 }
 
@@ -696,7 +1096,7 @@ static void set(struct context *context,
                 struct program_state *state,
                 struct byte_array *program)
 {
-    struct byte_array *name = serial_decode_string(program);    // destination variable name
+    struct byte_array *name = decode_name(context, program);    // destination variable name
     if (!context->runtime)
         VM_DEBUGPRINT("%s %s\n", op==VM_SET?"SET":"STX", byte_array_to_string(name));
 
@@ -705,7 +1105,7 @@ static void set(struct context *context,
     DEBUGPRINT("%s %s to %s\n",
                op==VM_SET ? "SET" : "STX",
                byte_array_to_string(name),
-               variable_value_str(context, value));
+               variable_trace_str(context, value));
 
     set_named_variable(context, state, name, value); // set the variable to the value
 }
@@ -737,6 +1137,7 @@ static void list_put(struct context *context, enum Opcode op, bool really)
     struct variable* recipient = variable_pop(context);
     struct variable* key = variable_pop(context);
     struct variable *value = get_value(context, op);
+    variable_realize(context, recipient);
 
     if (!really && custom_method(context, RESERVED_SET, recipient, key, value))
         return;
@@ -751,6 +1152,10 @@ static void list_put(struct context *context, enum Opcode op, bool really)
                 case VAR_BYT:
                     byte_array_set(recipient->str, key->integer, value->integer);
                     break;
+                case VAR_INTS:
+                case VAR_FLTS:
+                    variable_packed_set(context, recipient, key->integer, value);
+                    break;
                 default:
                     vm_exit_message(context, "indexing non-indexable");
             } break;
@@ -771,6 +1176,10 @@ static struct variable *binary_op_int(struct context *context,
     int32_t m = u->integer;
     int32_t n = v->integer;
     int32_t i;
+    if (op == VM_DIV || op == VM_MOD) {
+        vm_assert(context, n, "division by zero");
+        vm_assert(context, n != -1 || m != INT32_MIN, "integer overflow");
+    }
     switch (op) {
         case VM_MUL:    i = m * n;    break;
         case VM_DIV:    i = m / n;    break;
@@ -797,13 +1206,17 @@ static struct variable *binary_op_int(struct context *context,
     return variable_new_int(context, i);
 }
 
+static float float_value(const struct variable *v) {
+    return v->type == VAR_FLT ? v->floater : (float)v->integer;
+}
+
 static struct variable *binary_op_float(struct context *context,
                                         enum Opcode op,
                                         const struct variable *u,
                                         const struct variable *v)
 {
-    float m = u->floater;
-    float n = v->floater;
+    float m = float_value(u);
+    float n = float_value(v);
     float f = 0;
     switch (op) {
         case VM_MUL:    f = m * n;                                  break;
@@ -811,10 +1224,10 @@ static struct variable *binary_op_float(struct context *context,
         case VM_ADD:    f = m + n;                                  break;
         case VM_SUB:    f = m - n;                                  break;
         case VM_NEQ:    f = m != n;                                 break;
-        case VM_GTN:    return variable_new_int(context, n > m);
-        case VM_LTN:    return variable_new_int(context, n < m);
-        case VM_GRQ:    return variable_new_int(context, n >= m);
-        case VM_LEQ:    return variable_new_int(context, n <= m);
+        case VM_GTN:    return variable_new_int(context, m > n);
+        case VM_LTN:    return variable_new_int(context, m < n);
+        case VM_GRQ:    return variable_new_int(context, m >= n);
+        case VM_LEQ:    return variable_new_int(context, m <= n);
         default:
             return (struct variable*)vm_exit_message(context, "bad math float operator");
     }
@@ -836,7 +1249,7 @@ static struct variable *binary_op_str(struct context *context,
 
     switch (op) {
         case VM_ADD:
-            w = variable_new_str(context, byte_array_concatenate(2, vstr, ustr));
+            w = variable_new_str(context, byte_array_join(vstr, ustr));
             break;
         case VM_EQU:    w = variable_new_int(context, byte_array_equals(ustr, vstr));            break;
         default:
@@ -851,6 +1264,8 @@ static bool variable_compare(struct context *context, const struct variable *u,
 {
     if (!u != !v)
         return false;
+    variable_realize(context, (struct variable*)u);
+    variable_realize(context, (struct variable*)v);
     enum VarType ut = (enum VarType)u->type;
     enum VarType vt = (enum VarType)v->type;
 
@@ -871,6 +1286,8 @@ static bool variable_compare(struct context *context, const struct variable *u,
         case VAR_BOOL:
         case VAR_INT:   if (u->integer != v->integer)           return false; break;
         case VAR_FLT:   if (u->floater != v->floater)           return false; break;
+        case VAR_INTS:
+        case VAR_FLTS:
         case VAR_STR:   if (!byte_array_equals(u->str, v->str)) return false; break;
         default:
             return (bool)vm_exit_message(context, "bad comparison");
@@ -885,15 +1302,15 @@ static bool variable_compare_maps(struct context *context, const struct map *uma
         return true;
     if (!umap)
         return variable_compare_maps(context, vmap, umap);
-    struct array *keys = map_keys(umap);
+    const void *key;
+    void *uvalue;
+    uint32_t i = 0;
     if (!vmap)
-        return !keys->length;
+        return !map_iter(umap, &i, NULL, NULL);
 
-    for (int i=0; i<keys->length; i++) {
-        struct byte_array *key = (struct byte_array*)array_get(keys, i);
-        struct variable *uvalue = (struct variable*)map_get(umap, key);
+    for (; map_iter(umap, &i, &key, &uvalue);) {
         struct variable *vvalue = (struct variable*)map_get(vmap, key);
-        if (!variable_compare(context, uvalue, vvalue))
+        if (!variable_compare(context, (struct variable*)uvalue, vvalue))
             return false;
     }
     return true;
@@ -944,6 +1361,158 @@ static struct variable *binary_op_nil(struct context *context,
     }
 }
 
+// packed numbers //////////////////////////////////////////////////////////
+//
+// Element-wise kernels compute out[i] = a[i] op b[i], a vector of lanes at a
+// time where the compiler has vector extensions. An operand that isn't
+// stepped is a scalar, broadcast to every element. Comparisons make masks
+// of ones and zeros.
+
+#ifdef __GNUC__
+#define PACKED_VECTORS(V, VR, EXPR)                                             \
+    V x = (V){0} + a[0], y = (V){0} + b[0];                                     \
+    for (; i + PACKED_LANES <= n; i += PACKED_LANES) {                          \
+        if (sa)                                                                 \
+            memcpy(&x, a + i, sizeof(V));                                       \
+        if (sb)                                                                 \
+            memcpy(&y, b + i, sizeof(V));                                       \
+        VR r = (VR)(EXPR);                                                      \
+        memcpy(out + i, &r, sizeof(VR));                                        \
+    }
+#else
+#define PACKED_VECTORS(V, VR, EXPR)
+#endif
+
+#define PACKED_KERNEL(name, T, R, V, VR, EXPR)                                  \
+static void name(R *out, const T *a, const T *b, uint32_t n, bool sa, bool sb)  \
+{                                                                               \
+    uint32_t i = 0;                                                             \
+    PACKED_VECTORS(V, VR, EXPR)                                                 \
+    for (; i < n; i++) {                                                        \
+        T x = a[sa ? i : 0], y = b[sb ? i : 0];                                 \
+        out[i] = (R)(EXPR);                                                     \
+    }                                                                           \
+}
+
+PACKED_KERNEL(ints_add, int32_t, int32_t, packed_ints, packed_ints, x + y)
+PACKED_KERNEL(ints_sub, int32_t, int32_t, packed_ints, packed_ints, x - y)
+PACKED_KERNEL(ints_mul, int32_t, int32_t, packed_ints, packed_ints, x * y)
+PACKED_KERNEL(ints_div, int32_t, int32_t, packed_ints, packed_ints, x / y)
+PACKED_KERNEL(ints_gtn, int32_t, int32_t, packed_ints, packed_ints, (x > y) & 1)
+PACKED_KERNEL(ints_ltn, int32_t, int32_t, packed_ints, packed_ints, (x < y) & 1)
+PACKED_KERNEL(ints_grq, int32_t, int32_t, packed_ints, packed_ints, (x >= y) & 1)
+PACKED_KERNEL(ints_leq, int32_t, int32_t, packed_ints, packed_ints, (x <= y) & 1)
+PACKED_KERNEL(floats_add, float, float, packed_floats, packed_floats, x + y)
+PACKED_KERNEL(floats_sub, float, float, packed_floats, packed_floats, x - y)
+PACKED_KERNEL(floats_mul, float, float, packed_floats, packed_floats, x * y)
+PACKED_KERNEL(floats_div, float, float, packed_floats, packed_floats, x / y)
+PACKED_KERNEL(floats_gtn, float, int32_t, packed_floats, packed_ints, (x > y) & 1)
+PACKED_KERNEL(floats_ltn, float, int32_t, packed_floats, packed_ints, (x < y) & 1)
+PACKED_KERNEL(floats_grq, float, int32_t, packed_floats, packed_ints, (x >= y) & 1)
+PACKED_KERNEL(floats_leq, float, int32_t, packed_floats, packed_ints, (x <= y) & 1)
+
+struct packed_operand {
+    union {
+        int32_t integer;
+        float floater;
+    } scalar;
+    void *data;     // the elements, or the scalar
+    void *temp;     // ints converted to floats, to free
+    uint32_t length;
+    bool stepped;
+};
+
+static void packed_operand(struct context *context, const struct variable *v, bool floats,
+                           struct packed_operand *o)
+{
+    o->temp = NULL;
+    o->data = &o->scalar;
+    o->length = 1;
+    o->stepped = false;
+    switch (v->type) {
+        case VAR_BOOL:
+        case VAR_INT: {
+            int32_t i = v->type == VAR_BOOL ? v->boolean : v->integer;
+            if (floats)
+                o->scalar.floater = (float)i;
+            else
+                o->scalar.integer = i;
+        } break;
+        case VAR_FLT:
+            o->scalar.floater = v->floater; // so floats is set
+            break;
+        case VAR_INTS:
+        case VAR_FLTS:
+            o->data = v->str->data;
+            o->length = PACKED_LENGTH(v);
+            o->stepped = true;
+            if (floats && v->type == VAR_INTS) {
+                float *f = (float*)malloc(o->length * sizeof(float));
+                assert_message(f, ERROR_ALLOC);
+                for (uint32_t i=0; i<o->length; i++)
+                    f[i] = (float)((int32_t*)o->data)[i];
+                o->data = o->temp = f;
+            }
+            break;
+        default:
+            vm_exit_message(context, "can't do math on packed and %s", var_type_str(v->type));
+            break;
+    }
+}
+
+#define PACKED_CASE(op, kernel, R, T) \
+    case op: kernel((R*)w->str->data, (const T*)a.data, (const T*)b.data, n, a.stepped, b.stepped); break;
+
+static struct variable *binary_op_packed(struct context *context,
+                                         enum Opcode op,
+                                         const struct variable *u,
+                                         const struct variable *v)
+{
+    bool floats = u->type == VAR_FLTS || u->type == VAR_FLT || v->type == VAR_FLTS || v->type == VAR_FLT;
+    bool mask = op == VM_GTN || op == VM_LTN || op == VM_GRQ || op == VM_LEQ;
+    struct packed_operand a, b;
+    packed_operand(context, u, floats, &a);
+    packed_operand(context, v, floats, &b);
+    vm_assert(context, !a.stepped || !b.stepped || a.length == b.length, "packed lengths differ");
+    uint32_t n = a.stepped ? a.length : b.length;
+
+    if (op == VM_DIV && !floats)
+        for (uint32_t i=0; i<n; i++) {
+            int32_t x = ((int32_t*)a.data)[a.stepped ? i : 0], y = ((int32_t*)b.data)[b.stepped ? i : 0];
+            vm_assert(context, y, "division by zero");
+            vm_assert(context, y != -1 || x != INT32_MIN, "integer overflow"); // traps like / 0
+        }
+
+    struct variable *w = variable_new_packed(context, floats && !mask ? VAR_FLTS : VAR_INTS, n);
+    if (n && floats) switch (op) {
+        PACKED_CASE(VM_ADD, floats_add, float,   float)
+        PACKED_CASE(VM_SUB, floats_sub, float,   float)
+        PACKED_CASE(VM_MUL, floats_mul, float,   float)
+        PACKED_CASE(VM_DIV, floats_div, float,   float)
+        PACKED_CASE(VM_GTN, floats_gtn, int32_t, float)
+        PACKED_CASE(VM_LTN, floats_ltn, int32_t, float)
+        PACKED_CASE(VM_GRQ, floats_grq, int32_t, float)
+        PACKED_CASE(VM_LEQ, floats_leq, int32_t, float)
+        default:
+            vm_exit_message(context, "bad packed float operator");
+    } else if (n) switch (op) {
+        PACKED_CASE(VM_ADD, ints_add, int32_t, int32_t)
+        PACKED_CASE(VM_SUB, ints_sub, int32_t, int32_t)
+        PACKED_CASE(VM_MUL, ints_mul, int32_t, int32_t)
+        PACKED_CASE(VM_DIV, ints_div, int32_t, int32_t)
+        PACKED_CASE(VM_GTN, ints_gtn, int32_t, int32_t)
+        PACKED_CASE(VM_LTN, ints_ltn, int32_t, int32_t)
+        PACKED_CASE(VM_GRQ, ints_grq, int32_t, int32_t)
+        PACKED_CASE(VM_LEQ, ints_leq, int32_t, int32_t)
+        default:
+            vm_exit_message(context, "bad packed int operator");
+    }
+
+    free(a.temp);
+    free(b.temp);
+    return w;
+}
+
 static int32_t boolean_op(struct context *context, struct byte_array *program, enum Opcode op)
 {
     null_check(program);
@@ -976,6 +1545,8 @@ static void binary_op(struct context *context, enum Opcode op)
 
     struct variable *u = variable_pop(context);
     struct variable *v = variable_pop(context);
+    variable_realize(context, u);
+    variable_realize(context, v);
     enum VarType ut = (enum VarType)u->type;
     enum VarType vt = (enum VarType)v->type;
     struct variable *w;
@@ -988,8 +1559,10 @@ static void binary_op(struct context *context, enum Opcode op)
     } else {
         bool floater  = (ut == VAR_FLT && is_num(vt)) || (vt == VAR_FLT && is_num(ut));
         bool inter = (ut==VAR_INT || ut==VAR_BOOL) && (vt==VAR_INT || vt==VAR_BOOL);
+        bool packed = ut == VAR_INTS || ut == VAR_FLTS || vt == VAR_INTS || vt == VAR_FLTS;
 
-        if (floater)                                w = binary_op_float(context, op, u, v);
+        if (packed)                                 w = binary_op_packed(context, op, v, u);
+        else if (floater)                           w = binary_op_float(context, op, v, u);
         else if (inter)                             w = binary_op_int(context, op, v, u);
         else if (vt == VAR_STR || ut == VAR_STR)    w = binary_op_str(context, op, u, v);
         else if (vt == VAR_LST)                     w = binary_op_lst(context, op, u, v);
@@ -1001,9 +1574,9 @@ static void binary_op(struct context *context, enum Opcode op)
 
     DEBUGPRINT("%s(%s,%s) = %s\n",
                NUM_TO_STRING(opcodes, op),
-               variable_value_str(context, v),
-               variable_value_str(context, u),
-               variable_value_str(context, w));
+               variable_trace_str(context, v),
+               variable_trace_str(context, u),
+               variable_trace_str(context, w));
 }
 
 static void unary_op(struct context *context, enum Opcode op)
@@ -1052,8 +1625,40 @@ static void unary_op(struct context *context, enum Opcode op)
 
     DEBUGPRINT("%s(%s) = %s\n",
                NUM_TO_STRING(opcodes, op),
-               variable_value_str(context, v),
-               variable_value_str(context, result));
+               variable_trace_str(context, v),
+               variable_trace_str(context, result));
+}
+
+// an iterator is an object with a next method, which returns no value when done
+// the next method of what, if marked as an iterator; other maps with a next
+// item iterate over their list like any other
+static struct variable *iterator(struct context *context, const struct variable *what)
+{
+    if (!what->map)
+        return NULL;
+    struct byte_array *key = byte_array_from_string(RESERVED_ITERATOR);
+    struct variable *marker = (struct variable*)map_get(what->map, key);
+    byte_array_del(key);
+    if (!marker || marker->type != VAR_BOOL || !marker->boolean)
+        return NULL;
+    key = byte_array_from_string(RESERVED_NEXT);
+    struct variable *next = (struct variable*)map_get(what->map, key);
+    byte_array_del(key);
+    return (next && (next->type == VAR_FNC || next->type == VAR_C)) ? next : NULL;
+}
+
+static struct variable *iterator_next(struct context *context, struct variable *next, struct variable *what)
+{
+    struct variable *args = variable_new_src(context, 0);
+    array_add(args->list, what);
+    stack_push(context->operand_stack, args);
+    vm_call_src(context, next);
+
+    struct variable *result = (struct variable*)stack_peek(context->operand_stack, 0);
+    if (!result || result->type != VAR_SRC)
+        return NULL;
+    stack_pop(context->operand_stack);
+    return result->list->length ? (struct variable*)array_get(result->list, 0) : NULL;
 }
 
 // FOR who IN what WHERE where DO how
@@ -1062,9 +1667,9 @@ static bool iterate(struct context *context,
                     struct program_state *state,
                     struct byte_array *program)
 {
-    struct byte_array *who = serial_decode_string(program);
-    struct byte_array *where = serial_decode_string(program);
-    struct byte_array *how = serial_decode_string(program);
+    struct byte_array *who = decode_name(context, program);
+    struct byte_array *where = serial_decode_view(program);
+    struct byte_array *how = serial_decode_view(program);
 
 #ifdef DEBUG
     DEBUGPRINT("%s %s\n",
@@ -1085,10 +1690,15 @@ static bool iterate(struct context *context,
     struct variable *result = comprehending ? variable_new_list(context, NULL) : NULL;
 
     struct variable *what = variable_pop(context);
-    uint32_t len = variable_length(context, what);
-    for (int i=0; i<len; i++) {
-
-        struct variable *that = list_get_int(context, what, i);
+    struct variable *next = iterator(context, what);
+    uint32_t len = next ? UINT32_MAX : variable_length(context, what);
+    for (uint32_t i=0; i<len; i++) {
+
+        struct variable *that;
+        if (!next)
+            that = list_get_int(context, what, i);
+        else if (!(that = iterator_next(context, next, what)))
+            break;
         set_named_variable(context, state, who, that);
 
         byte_array_reset(where);
@@ -1114,13 +1724,17 @@ static bool iterate(struct context *context,
 
 static inline bool vm_trycatch(struct context *context, struct byte_array *program)
 {
-    struct byte_array *trial = serial_decode_string(program);
+    struct byte_array *trial = serial_decode_view(program);
     DEBUGPRINT("TRY %d\n", trial->length);
+#ifdef DEBUG
     display_code(context, trial);
-    struct byte_array *name = serial_decode_string(program);
-    struct byte_array *catcher = serial_decode_string(program);
+#endif
+    struct byte_array *name = decode_name(context, program);
+    struct byte_array *catcher = serial_decode_view(program);
     DEBUGPRINT("%sCATCH %s %d\n", indentation(context), byte_array_to_string(name), catcher->length);
+#ifdef DEBUG
     display_code(context, catcher);
+#endif
     if (!context->runtime)
         return false;
 
@@ -1155,11 +1769,13 @@ bool run(struct context *context,
 {
     null_check(context);
     null_check(program);
-    program = byte_array_copy(program);
-    program->current = program->data;
+    struct byte_array code = *program; // runs in place, with its own program counter
+    code.current = code.data;
+    program = &code;
     struct program_state *state = NULL;
     enum Opcode inst = VM_NIL;
     if (context->runtime) {
+        stack_reserve(context->operand_stack, stack_depth(context->operand_stack) + max_depth);
         if (in_context) {
             if (!state)
                 state = (struct program_state*)stack_peek(context->program_stack, 0);
@@ -1241,24 +1857,31 @@ done:
     return inst == VM_RET;
 }
 
-void execute(struct byte_array *program, find_c_var *find)
+// runs program with env as its global variables
+void execute_env(struct byte_array *program, find_c_var *find, struct map *env)
 {
+    null_check(program);
+    struct context *context = context_new(false);
+    context->find = find;
+    if (setjmp(trying))
+        exit_message("%s", context->error ? byte_array_to_string(context->error->str) : ERROR_VERIFY);
+    verify(context, program);
+
 #ifdef DEBUG
     display_program(program);
 #endif
 
     DEBUGPRINT("execute:\n");
-    null_check(program);
-    program = byte_array_copy(program);
-    byte_array_reset(program);
 
-    struct context *context = context_new(false);
-    context->find = find;
 #ifdef DEBUG
     context->indent = 1;
 #endif
     if (!setjmp(trying))
-        run(context, program, NULL, false);
+        run(context, program, env, false);
 
     assert_message(stack_empty(context->operand_stack), "operand stack not empty");
 }
+
+void execute(struct byte_array *program, find_c_var *find) {
+    execute_env(program, find, NULL);
+}
@@ -12,6 +12,9 @@
 
 #define RESERVED_ENV "env"
 #define RESERVED_GET "get"
+#define RESERVED_ITERATOR "iterator" // true if for-in calls next, not indexes
+
+#define SORT_PARALLEL 100000 // default list length to sort on several threads
 
 struct context {
     struct variable *vm_exception;
@@ -23,6 +26,11 @@ struct context {
     uint32_t num_vars;
     uint8_t indent;
     find_c_var *find;
+    struct map *interns; // variable names, see byte_array_intern
+    struct map *names;   // interned names and keys by where they are in byte code, see verify
+    uint32_t sort_parallel; // lists longer than this sort on several threads
+    uint32_t sort_threads;  // at most this many
+    struct byte_array *buffer; // reused for output that is consumed at once
 };
 
 struct program_state {
@@ -84,13 +92,20 @@ enum Opcode {
 };
 
 #define ERROR_OPCODE "unknown opcode"
+#define ERROR_VERIFY "bad byte code"
 
 #ifdef DEBUG
 void display_program(struct byte_array* program);
 #endif
 struct context *context_new(bool state);
+struct byte_array *context_buffer(struct context *context);
 void execute(struct byte_array *program,
              find_c_var *find);
+void execute_env(struct byte_array *program,
+                 find_c_var *find,
+                 struct map *env);
+uint32_t verify(struct context *context, const struct byte_array *program);
+void unverify(struct context *context, const struct byte_array *code);
 void garbage_collect(struct context *context);
 void vm_call(struct context *context, struct variable *func, struct variable *arg,...);
 void *vm_exit_message(struct context *context, const char *format, ...);